@@ -2,8 +2,29 @@
 message("-- [INFO] Building DFU Library")
 file(GLOB_RECURSE SRC_DFU_FILES "src-dfu/*.cpp" "src-dfu/*.c")
 add_library(dfu SHARED ${SRC_DFU_FILES})
+# Major version 2: NrfDfuServer's layout changed when it started deriving from BasicDfuServer
+set_target_properties(dfu PROPERTIES VERSION 2.0.0 SOVERSION 2)
 add_library(dfu-static STATIC ${SRC_DFU_FILES})
-file(COPY "src-dfu/NrfDfuServer.h" "src-dfu/NrfDfuServerTypes.h" DESTINATION ${OUTPUT_DIR})
+find_package(Threads REQUIRED)
+target_link_libraries(dfu ${CMAKE_THREAD_LIBS_INIT})
+target_link_libraries(dfu-static ${CMAKE_THREAD_LIBS_INIT})
+file(COPY "src-dfu/NrfDfuServer.h" "src-dfu/NrfDfuServerTypes.h" "src-dfu/BasicDfuServer.h" "src-dfu/BasicDfuServerImpl.h"
+     DESTINATION ${OUTPUT_DIR})
+
+message("-- [INFO] Building DFU CRC Benchmark")
+add_executable(dfu_crc_bench ${PROJECT_DIR_PATH}/src-dfu-bench/crc_bench.cpp)
+target_include_directories(dfu_crc_bench PRIVATE ${PROJECT_DIR_PATH}/src-dfu)
+target_link_libraries(dfu_crc_bench dfu-static)
+
+message("-- [INFO] Building DFU Link Benchmark")
+add_executable(dfu_link_bench ${PROJECT_DIR_PATH}/src-dfu-bench/link_bench.cpp)
+target_include_directories(dfu_link_bench PRIVATE ${PROJECT_DIR_PATH}/src-dfu)
+target_link_libraries(dfu_link_bench dfu-static)
+
+message("-- [INFO] Building DFU Stress Test")
+add_executable(dfu_stress ${PROJECT_DIR_PATH}/src-dfu-bench/stress.cpp)
+target_include_directories(dfu_stress PRIVATE ${PROJECT_DIR_PATH}/src-dfu)
+target_link_libraries(dfu_stress dfu-static)
 
 message("-- [INFO] Building DFU Library Test Application")
 # BLE Platform Dependant Library Configuration
@@ -31,4 +52,4 @@ file(GLOB_RECURSE SRC_MINIZ_FILES "src-dfu-app/miniz/*.c" )
 
 add_executable(dfu_app ${SRC_DFU_TEST_FILES} ${SRC_MINIZ_FILES})
 target_link_libraries(dfu_app ${LIB_BLE} dfu-static)
-target_compile_definitions(dfu_app PUBLIC MINIZ_STATIC_DEFINE)
+target_compile_definitions(dfu_app PUBLIC MINIZ_STATIC_DEFINE MINIZ_DISABLE_ZIP_READER_CRC32_CHECKS)
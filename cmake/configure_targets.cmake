@@ -5,6 +5,12 @@
 # message("-- CMAKE_SYSTEM:           ${CMAKE_SYSTEM}")
 # message(${CMAKE_SIZEOF_VOID_P}) # We'll keep this for later.
 
+# Release unless asked otherwise, as the toolchain scripts do: the benchmarks and the CRC code they measure must be
+# optimized. Multi-config generators (Visual Studio) pick the configuration at build time instead
+if(NOT CMAKE_BUILD_TYPE AND NOT CMAKE_CONFIGURATION_TYPES)
+    set(CMAKE_BUILD_TYPE Release CACHE STRING "Build type" FORCE)
+endif()
+
 # Configure Compiler Flags for each Platform
 IF (CMAKE_SYSTEM_NAME STREQUAL "Windows")
     set(WINVERSION_CODE 0x0A00) # Selected Windows 10 based on https://docs.microsoft.com/en-us/cpp/porting/modifying-winver-and-win32-winnt
@@ -46,4 +52,20 @@ if(DEFINE_DEBUG)
 
     ENDIF()
 
-endif()
\ No newline at end of file
+endif()
+
+if(SANITIZE_THREAD)
+    message(STATUS "THREAD SANITIZER ENABLED")
+
+    IF (CMAKE_SYSTEM_NAME STREQUAL "Windows")
+        message(WARNING "ThreadSanitizer is not available with MSVC, SANITIZE_THREAD ignored")
+
+    ELSE()
+        set(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} -fsanitize=thread -g -O1")
+        set(CMAKE_C_FLAGS "${CMAKE_C_FLAGS} -fsanitize=thread -g -O1")
+        set(CMAKE_EXE_LINKER_FLAGS "${CMAKE_EXE_LINKER_FLAGS} -fsanitize=thread")
+        set(CMAKE_SHARED_LINKER_FLAGS "${CMAKE_SHARED_LINKER_FLAGS} -fsanitize=thread")
+
+    ENDIF()
+
+endif()
@@ -1,19 +1,23 @@
 #include "NativeBleController.h"
 #include "NrfDfuServer.h"
+#include "crc.h"
 #include "json/json.hpp"
 #include "miniz/miniz.h"
 #include "utils.h"
 
+#include <algorithm>
 #include <cerrno>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <vector>
 
 #define SCAN_DURATION_MS 2500
 
-static bool get_bin_dat_files(std::string&, std::string&, const char*);
+static bool get_bin_dat_files(std::string&, std::string&, std::vector<uint32_t>&, const char*);
+static bool extract_file(mz_zip_archive*, const char*, std::string&, std::vector<uint32_t>*);
 
 /**
  * main
@@ -43,8 +47,9 @@ int main(int argc, char* argv[]) {
     bool device_found = false;
     std::string data_file;
     std::string bin_file;
+    std::vector<uint32_t> bin_page_crcs;
 
-    if (!get_bin_dat_files(bin_file, data_file, dfu_zip_filepath)) {
+    if (!get_bin_dat_files(bin_file, data_file, bin_page_crcs, dfu_zip_filepath)) {
         std::cout << "Could not parse DFU zip file!" << std::endl;
         return -1;
     }
@@ -64,12 +69,21 @@ int main(int argc, char* argv[]) {
 
     NativeBLE::NativeBleController ble;
     NativeBLE::CallbackHolder callback_holder;
-    NativeDFU::NrfDfuServer dfu_server([&](std::string service, std::string characteristic,
-                                           std::string data) { ble.write_command(service, characteristic, data); },
-                                       [&](std::string service, std::string characteristic, std::string data) {
-                                           ble.write_request(service, characteristic, data);
-                                       },
-                                       data_file, bin_file);
+    // DFU characteristic handles are mapped to the UUIDs the BLE library expects, resolved once here
+    const NativeBLE::BluetoothUUID dfu_service = NativeDFU::NrfDfuServer::service_uuid();
+    const NativeBLE::BluetoothUUID dfu_characteristics[] = {
+        NativeDFU::NrfDfuServer::characteristic_uuid(NativeDFU::DFU_CONTROL_POINT),
+        NativeDFU::NrfDfuServer::characteristic_uuid(NativeDFU::DFU_PACKET)};
+    NativeDFU::NrfDfuServer dfu_server(
+        [&](NativeDFU::dfu_characteristic_t characteristic, const uint8_t* data, size_t length) {
+            ble.write_command(dfu_service, dfu_characteristics[characteristic],
+                              NativeBLE::DataChunk(reinterpret_cast<const char*>(data), length));
+        },
+        [&](NativeDFU::dfu_characteristic_t characteristic, const uint8_t* data, size_t length) {
+            ble.write_request(dfu_service, dfu_characteristics[characteristic],
+                              NativeBLE::DataChunk(reinterpret_cast<const char*>(data), length));
+        },
+        data_file, bin_file, bin_page_crcs);
 
     callback_holder.callback_on_scan_found = [&](NativeBLE::DeviceDescriptor device) {
         if (is_mac_addr_match(device.address, device_dfu_ble_address)) {
@@ -101,8 +115,7 @@ int main(int argc, char* argv[]) {
             received_data << std::endl;
             std::cout << received_data.str();
             // std::cout << "Calling Notify" << std::endl;
-            dfu_server.notify(NORDIC_SECURE_DFU_SERVICE, NORDIC_DFU_CONTROL_POINT_CHAR,
-                              std::string(reinterpret_cast<const char*>(data), length));
+            dfu_server.notify(NativeDFU::DFU_CONTROL_POINT, data, length);
         });
 
         dfu_server.run_dfu();
@@ -118,47 +131,98 @@ int main(int argc, char* argv[]) {
     return 0;
 }
 
-// Reads the manifest.json file to retrieve .bin and .dat files from DFU package.
-bool get_bin_dat_files(std::string& bin, std::string& dat, const char* dfu_zip_path) {
-    mz_zip_archive* zip_archive = new mz_zip_archive;
-    char* manifest_file;
+// Reads the manifest.json file to retrieve .bin and .dat files from DFU package. The CRC of the bin file up to the end
+// of every flash page is stored in bin_page_crcs while it is extracted.
+bool get_bin_dat_files(std::string& bin, std::string& dat, std::vector<uint32_t>& bin_page_crcs,
+                       const char* dfu_zip_path) {
+    mz_zip_archive zip_archive;
+    std::string manifest_file;
     nlohmann::json json_manifest;
     std::string bin_filename;
-    size_t bin_size;
-    char* bin_contents;
     std::string dat_filename;
-    size_t dat_size;
-    char* dat_contents;
+    bool success = false;
 
-    mz_zip_zero_struct(zip_archive);
-    mz_zip_reader_init_file(zip_archive, dfu_zip_path, 0);
-
-    manifest_file = (char*)mz_zip_reader_extract_file_to_heap(zip_archive, "manifest.json", (size_t*)NULL,
-                                                              (mz_uint)NULL);
-    if (!manifest_file) {
+    mz_zip_zero_struct(&zip_archive);
+    if (!mz_zip_reader_init_file(&zip_archive, dfu_zip_path, 0)) {
         return false;
     }
 
-    json_manifest = nlohmann::json::parse(manifest_file);
+    if (extract_file(&zip_archive, "manifest.json", manifest_file, nullptr)) {
+        json_manifest = nlohmann::json::parse(manifest_file);
+
+        bin_filename = json_manifest["manifest"]["application"]["bin_file"];
+        dat_filename = json_manifest["manifest"]["application"]["dat_file"];
+
+        success = extract_file(&zip_archive, dat_filename.c_str(), dat, nullptr) &&
+                  extract_file(&zip_archive, bin_filename.c_str(), bin, &bin_page_crcs);
+    }
+
+    mz_zip_reader_end(&zip_archive);
+    return success;
+}
+
+struct extract_state_t {
+    std::string* contents;
+    std::vector<uint32_t>* page_crcs;
+    crc remainder;
+};
+
+// Called by miniz with each block of inflated data while it is still in the decompression window: the block is
+// appended to the output and checksummed in the same pass, recording the CRC at every flash page boundary.
+static size_t extract_write(void* opaque, mz_uint64 file_offset, const void* buffer, size_t length) {
+    extract_state_t* state = static_cast<extract_state_t*>(opaque);
+    const unsigned char* data = static_cast<const unsigned char*>(buffer);
+
+    if (file_offset != state->contents->length()) {
+        return 0;
+    }
+    state->contents->append(static_cast<const char*>(buffer), length);
 
-    bin_filename = json_manifest["manifest"]["application"]["bin_file"];
-    dat_filename = json_manifest["manifest"]["application"]["dat_file"];
+    while (length) {
+        size_t page_remaining = length;
+        if (state->page_crcs) {
+            page_remaining = FLASH_PAGE_SIZE - (file_offset % FLASH_PAGE_SIZE);
+        }
+        size_t chunk = std::min(length, page_remaining);
+        state->remainder = crcUpdate(state->remainder, data, chunk);
+        if (state->page_crcs && chunk == page_remaining) {
+            state->page_crcs->push_back(crcFinalize(state->remainder));
+        }
+        data += chunk;
+        file_offset += chunk;
+        length -= chunk;
+    }
+    return data - static_cast<const unsigned char*>(buffer);
+}
 
-    dat_contents = (char*)mz_zip_reader_extract_file_to_heap(zip_archive, dat_filename.c_str(), &dat_size,
-                                                             (mz_uint)NULL);
-    bin_contents = (char*)mz_zip_reader_extract_file_to_heap(zip_archive, bin_filename.c_str(), &bin_size,
-                                                             (mz_uint)NULL);
-    if (!dat_contents || !bin_contents) {
+// Extracts a file of the zip archive into contents, checking it against the CRC32 stored in the archive. miniz is
+// built with MINIZ_DISABLE_ZIP_READER_CRC32_CHECKS, the check is done here on the same pass as the page CRCs.
+bool extract_file(mz_zip_archive* zip_archive, const char* filename, std::string& contents,
+                  std::vector<uint32_t>* page_crcs) {
+    mz_zip_archive_file_stat file_stat;
+    int file_index = mz_zip_reader_locate_file(zip_archive, filename, nullptr, 0);
+    if (file_index < 0 || !mz_zip_reader_file_stat(zip_archive, file_index, &file_stat)) {
         return false;
     }
 
-    bin = std::string(bin_contents, bin_size);
-    dat = std::string(dat_contents, dat_size);
+    contents.clear();
+    contents.reserve(file_stat.m_uncomp_size);
+    if (page_crcs) {
+        page_crcs->clear();
+        page_crcs->reserve((file_stat.m_uncomp_size + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE);
+    }
 
-    zip_archive->m_pFree(zip_archive->m_pAlloc_opaque, manifest_file);
-    zip_archive->m_pFree(zip_archive->m_pAlloc_opaque, dat_contents);
-    zip_archive->m_pFree(zip_archive->m_pAlloc_opaque, bin_contents);
-    delete zip_archive;
+    extract_state_t state = {&contents, page_crcs, crcStart()};
+    if (!mz_zip_reader_extract_to_callback(zip_archive, file_index, extract_write, &state, 0)) {
+        return false;
+    }
+    if (contents.length() != file_stat.m_uncomp_size || crcFinalize(state.remainder) != file_stat.m_crc32) {
+        return false;
+    }
 
+    // Last, partial flash page
+    if (page_crcs && contents.length() % FLASH_PAGE_SIZE) {
+        page_crcs->push_back(crcFinalize(state.remainder));
+    }
     return true;
 }
\ No newline at end of file
@@ -0,0 +1,174 @@
+#include "NrfDfuServerTypes.h"
+#include "crc.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define HAVE_TSC
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC
+#endif
+
+#define DEFAULT_MAX_SIZE (16 * 1024 * 1024)
+#define MIN_BENCH_BYTES (16 * 1024 * 1024)  // Repeat small sizes until at least this much data was hashed
+#define BENCH_RUNS 3                        // Best of
+
+typedef std::function<crc(const unsigned char *, size_t)> crc_function_t;
+
+struct sample_t {
+    double seconds;
+    double cycles;
+};
+
+static volatile crc sink;  // Keeps the compiler from dropping the CRC computations
+
+static sample_t measure(const std::function<void()> &work, size_t repetitions) {
+    sample_t best = {1e300, 1e300};
+    for (int run = 0; run < BENCH_RUNS; run++) {
+#ifdef HAVE_TSC
+        unsigned long long cycles_start = __rdtsc();
+#endif
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < repetitions; i++) {
+            work();
+        }
+        auto end = std::chrono::steady_clock::now();
+#ifdef HAVE_TSC
+        double cycles = static_cast<double>(__rdtsc() - cycles_start);
+#else
+        double cycles = 0;
+#endif
+        double seconds = std::chrono::duration<double>(end - start).count() / repetitions;
+        if (seconds < best.seconds) {
+            best = {seconds, cycles / repetitions};
+        }
+    }
+    return best;
+}
+
+static void print_header(const std::string &first_column) {
+    std::cout << std::left << std::setw(20) << first_column << std::setw(12) << "size" << std::setw(11) << "align"
+              << std::right << std::setw(10) << "GB/s" << std::setw(12) << "cycles/B" << std::endl;
+}
+
+static void bench_kernel(const std::string &name, const crc_function_t &function, const unsigned char *buffer,
+                         size_t max_size, size_t size_limit) {
+    for (size_t size = 64; size <= std::min(max_size, size_limit); size *= 4) {
+        for (size_t offset : {0, 1}) {
+            size_t repetitions = std::max<size_t>(1, MIN_BENCH_BYTES / size);
+            if (size_limit < max_size) {
+                repetitions = std::max<size_t>(1, repetitions / 64);  // crcSlow
+            }
+            sample_t sample = measure([&] { sink = function(buffer + offset, size); }, repetitions);
+
+            std::cout << std::left << std::setw(20) << name << std::setw(12) << size << std::setw(11)
+                      << (offset ? "unaligned" : "aligned") << std::right << std::fixed << std::setprecision(2)
+                      << std::setw(10) << (size / sample.seconds / 1e9);
+#ifdef HAVE_TSC
+            std::cout << std::setw(12) << (sample.cycles / size);
+#else
+            std::cout << std::setw(12) << "-";
+#endif
+            std::cout << std::endl;
+        }
+    }
+}
+
+// Checksums done by NrfDfuServer while sending an image: one CRC of the whole prefix per FLASH_PAGE_SIZE object.
+static void bench_dfu_pattern(const unsigned char *image, size_t max_size) {
+    std::cout << std::endl << "Per-DFU checksum cost (one CRC per " << FLASH_PAGE_SIZE << " byte object)" << std::endl;
+    std::cout << std::left << std::setw(12) << "image" << std::right << std::setw(16) << "prefix (ms)" << std::setw(16)
+              << "running (ms)" << std::setw(12) << "speedup" << std::endl;
+
+    for (size_t image_size : {64 * 1024, 256 * 1024, 512 * 1024, 900 * 1024, 1024 * 1024, 4 * 1024 * 1024}) {
+        if (image_size > max_size) {
+            break;
+        }
+
+        // Before: every object rehashes the image from byte 0.
+        sample_t prefix = measure(
+            [&] {
+                for (size_t end = FLASH_PAGE_SIZE; end < image_size + FLASH_PAGE_SIZE; end += FLASH_PAGE_SIZE) {
+                    sink = crcFast(image, std::min(end, image_size));
+                }
+            },
+            1);
+
+        // Now: the running remainder is extended by one object at a time.
+        sample_t running = measure(
+            [&] {
+                crc remainder = crcStart();
+                for (size_t start = 0; start < image_size; start += FLASH_PAGE_SIZE) {
+                    size_t length = std::min<size_t>(FLASH_PAGE_SIZE, image_size - start);
+                    remainder = crcUpdate(remainder, image + start, length);
+                    sink = crcFinalize(remainder);
+                }
+            },
+            16);
+
+        std::cout << std::left << std::setw(12) << image_size << std::right << std::fixed << std::setprecision(3)
+                  << std::setw(16) << prefix.seconds * 1e3 << std::setw(16) << running.seconds * 1e3
+                  << std::setprecision(1) << std::setw(11) << prefix.seconds / running.seconds << "x" << std::endl;
+    }
+}
+
+/**
+ * main
+ *
+ * CRC micro-benchmark.
+ * Usage: dfu_crc_bench [max_size]
+ *      -max_size: Largest buffer to hash, in bytes (default 16 MiB)
+ *
+ */
+int main(int argc, char *argv[]) {
+    size_t max_size = (argc > 1) ? std::strtoull(argv[1], nullptr, 10) : DEFAULT_MAX_SIZE;
+    if (max_size < 64) {
+        std::cout << "Usage: " << argv[0] << " [max_size]" << std::endl;
+        return -1;
+    }
+
+    std::vector<unsigned char> buffer(max_size + 64);
+    unsigned int seed = 1;
+    for (auto &byte : buffer) {
+        seed = seed * 1103515245u + 12345u;
+        byte = static_cast<unsigned char>(seed >> 16);
+    }
+    // Aligned runs start on a 64 byte boundary, unaligned runs one byte later.
+    const unsigned char *aligned = buffer.data() + (64 - reinterpret_cast<uintptr_t>(buffer.data()) % 64) % 64;
+
+    std::cout << "Active kernel: " << crcKernelName(crcActiveKernel()) << std::endl;
+#ifndef HAVE_TSC
+    std::cout << "No cycle counter on this platform, cycles/B not reported" << std::endl;
+#endif
+    std::cout << std::endl;
+    print_header("kernel");
+
+    bench_kernel("crcSlow", crcSlow, aligned, max_size, 256 * 1024);
+    bench_kernel("crcFast", crcFast, aligned, max_size, max_size);
+    for (int index = 0; index < CRC_KERNEL_COUNT; index++) {
+        crcKernel kernel = static_cast<crcKernel>(index);
+        if (!crcKernelSupported(kernel)) {
+            continue;
+        }
+        bench_kernel(crcKernelName(kernel),
+                     [kernel](const unsigned char *message, size_t length) {
+                         return crcFinalize(crcUpdateKernel(kernel, crcStart(), message, length));
+                     },
+                     aligned, max_size, max_size);
+    }
+    bench_kernel("crcParallel",
+                 [](const unsigned char *message, size_t length) { return crcParallel(message, length, 0); }, aligned,
+                 max_size, max_size);
+
+    bench_dfu_pattern(aligned, max_size);
+    return 0;
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include "NrfDfuServerTypes.h"
+#include "crc.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#define BOOTLOADER_COMMAND_MAX 256
+#define BOOTLOADER_DATA_MAX 4096
+
+namespace NativeDFU {
+
+// Nordic Secure DFU bootloader, as much of it as NrfDfuServer uses. Responses and receipts go out through notify, on
+// the thread that wrote the request or packet.
+class EmulatedBootloader {
+  public:
+    std::function<void(const std::string &)> notify;
+    size_t image_size = 0;
+    uint32_t drop_every = 0;  // Every drop_every-th packet is lost, 0 for none
+    bool finished = false;
+    bool strict_execute = false;  // Refuses to execute an object a second time with OP_NOT_PERM_RESP, as Nordic's does
+    uint32_t data_object_max = BOOTLOADER_DATA_MAX;  // Largest data object, reported to SELECT. Set before preload
+
+    // * Faults, indexed by request opcode: the n-th request with it (counted from 1) fails, or its response is lost
+    std::array<uint32_t, DFU_ABORT_KEY + 1> fail_request{};
+    std::array<uint32_t, DFU_ABORT_KEY + 1> drop_response{};
+
+    // Starts from where an interrupted DFU left the device: the command object (executed if not empty) and the image
+    // received, executed up to executed_offset. The data object after it is open, so call with image_size set.
+    void preload(const std::string &command_object, const std::string &image_object, uint32_t executed_offset) {
+        command = command_object;
+        command_end = command.size();
+        command_executed = !command.empty();
+        image = image_object;
+        executed = executed_offset;
+        image_end = executed + std::min<uint32_t>(data_object_max, image_size - executed);
+    }
+
+    void request(const std::string &data) {
+        if (finished) {
+            return;  // Resetting into the new application
+        }
+        uint8_t opcode = data[0];
+        uint32_t count = (opcode < requests.size()) ? ++requests[opcode] : 0;
+        if (count && count == fail_request[opcode]) {
+            reply(response(opcode, OP_FAILED_RESP));
+            return;
+        }
+        switch (opcode) {
+            case PACKET_RECEIPT_NOTIF_REQ_KEY:
+                prn = *reinterpret_cast<const uint16_t *>(&data[1]);
+                prn_count = 0;
+                reply(response(opcode, SUCCESS_RESP));
+                break;
+
+            case MTU_GET_KEY:
+                reply(response(opcode, SUCCESS_RESP, std::string(2, '\0')));  // BLE leaves it to the ATT MTU
+                break;
+
+            case SELECT_OBJECT_KEY:
+                selected = static_cast<object_type_t>(data[1]);
+                reply(response(opcode, SUCCESS_RESP,
+                               le32(selected == COMMAND ? BOOTLOADER_COMMAND_MAX : data_object_max) +
+                                   object_checksum()));
+                break;
+
+            case CREATE_KEY: {
+                selected = static_cast<object_type_t>(data[1]);
+                uint32_t size = *reinterpret_cast<const uint32_t *>(&data[2]);
+                if (size > ((selected == COMMAND) ? BOOTLOADER_COMMAND_MAX : data_object_max)) {
+                    reply(response(opcode, INSUFF_RESOURCES_RESP));
+                    break;
+                }
+                if (selected == COMMAND) {
+                    command.clear();
+                    command_end = size;
+                    command_executed = false;
+                } else {
+                    image.resize(executed);
+                    image_end = executed + size;
+                }
+                prn_count = 0;
+                reply(response(opcode, SUCCESS_RESP));
+                break;
+            }
+
+            case CALCULATE_CHECKSUM_KEY:
+                reply(response(opcode, SUCCESS_RESP, object_checksum()));
+                break;
+
+            case EXECUTE_KEY:
+                if (strict_execute && ((selected == COMMAND) ? command_executed : image.size() == executed)) {
+                    reply(response(opcode, OP_NOT_PERM_RESP));
+                    break;
+                }
+                if (selected == COMMAND) {
+                    command_executed = true;
+                } else {
+                    executed = image.size();
+                    finished = (executed == image_size);
+                }
+                reply(response(opcode, SUCCESS_RESP));
+                break;
+
+            default:
+                reply(response(opcode, OPCODE_NOT_SUP_RESP));
+                break;
+        }
+    }
+
+    void packet(const std::string &data) {
+        if (drop_every && ++packets % drop_every == 0) {
+            return;
+        }
+        std::string &object = (selected == COMMAND) ? command : image;
+        if (object.size() + data.size() > ((selected == COMMAND) ? command_end : image_end)) {
+            return;
+        }
+        object += data;
+        if (prn && ++prn_count == prn) {
+            prn_count = 0;
+            notify(response(CALCULATE_CHECKSUM_KEY, SUCCESS_RESP, object_checksum()));
+        }
+    }
+
+  private:
+    // Response to the request being handled, unless drop_response loses it
+    void reply(const std::string &data) {
+        uint8_t opcode = data[1];
+        if (opcode < requests.size() && requests[opcode] == drop_response[opcode]) {
+            return;
+        }
+        notify(data);
+    }
+
+    static std::string response(uint8_t opcode, uint8_t result, const std::string &value = std::string()) {
+        return std::string() + char(RESPONSE_CODE_KEY) + char(opcode) + char(result) + value;
+    }
+
+    static std::string le32(uint32_t value) { return std::string(reinterpret_cast<const char *>(&value), 4); }
+
+    std::string object_checksum() {
+        const std::string &object = (selected == COMMAND) ? command : image;
+        crc checksum = crcFast(reinterpret_cast<const unsigned char *>(object.data()), object.size());
+        return le32(static_cast<uint32_t>(object.size())) + le32(checksum);
+    }
+
+    uint16_t prn = 0;
+    uint16_t prn_count = 0;
+    uint32_t packets = 0;
+    object_type_t selected = COMMAND;
+    std::string command;
+    uint32_t command_end = 0;
+    std::string image;
+    uint32_t image_end = 0;
+    uint32_t executed = 0;
+    bool command_executed = false;
+    std::array<uint32_t, DFU_ABORT_KEY + 1> requests{};  // Received so far, by opcode
+};
+
+}  // namespace NativeDFU
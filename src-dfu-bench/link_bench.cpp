@@ -0,0 +1,222 @@
+#include "NrfDfuServer.h"
+#include "emulated_bootloader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace NativeDFU;
+
+#define DEFAULT_IMAGE_SIZE (128 * 1024)
+#define DATA_FILE_SIZE 141  // Typical signed init packet
+
+// Link the devices connect with: power saving interval, 1M PHY, no data length extension
+#define POWER_SAVING_INTERVAL_US 50000
+#define LEGACY_DATA_LENGTH 27
+
+#define LINK_ATT_MTU 247
+#define LINK_QUEUE_DEPTH 16           // Write commands the emulated controller buffers
+#define CONNECTION_UPDATE_EVENTS 6    // Connection events before a parameter or PHY update takes effect
+#define T_IFS_US 150                  // Inter frame space
+#define EVENT_LENGTH_PERCENT 90       // Share of the interval the controller spends transmitting
+
+struct link_params_t {
+    uint32_t interval_us;
+    bool phy_2m;
+    uint16_t data_length;
+};
+
+// Air time of one ATT PDU and the empty PDUs acknowledging it, fragmented in LL PDUs of up to data_length bytes.
+static double airtime_us(size_t att_value_length, const link_params_t &link) {
+    size_t l2cap_length = att_value_length + 3 + 4;  // ATT opcode and handle, L2CAP header
+    size_t pdus = (l2cap_length + link.data_length - 1) / link.data_length;
+    double bits_per_us = link.phy_2m ? 2 : 1;
+    size_t pdu_overhead = (link.phy_2m ? 2 : 1) + 4 + 2 + 3;  // Preamble, access address, header, CRC
+    double data_us = (l2cap_length + pdus * pdu_overhead) * 8 / bits_per_us;
+    double ack_us = pdus * (2 * T_IFS_US + pdu_overhead * 8 / bits_per_us);
+    return data_us + ack_us;
+}
+
+// Connection between the server and the bootloader: writes and notifications only move during connection events,
+// as many as their air time fits in.
+class EmulatedLink {
+  public:
+    EmulatedLink(const link_params_t &params, EmulatedBootloader &bootloader) : params(params), bootloader(bootloader) {
+        bootloader.notify = [this](const std::string &data) { notifications.push_back(data); };
+    }
+
+    ~EmulatedLink() {
+        stop = true;
+        if (radio.joinable()) {
+            radio.join();
+        }
+    }
+
+    dfu_transport_t transport(bool connection_profile) {
+        dfu_transport_t transport;
+        transport.write_command = [this](dfu_characteristic_t, const uint8_t *data, size_t length) {
+            std::lock_guard<std::mutex> guard(mutex);
+            writes.push_back({true, std::string(reinterpret_cast<const char *>(data), length)});
+        };
+        transport.write_request = [this](dfu_characteristic_t, const uint8_t *data, size_t length) {
+            std::lock_guard<std::mutex> guard(mutex);
+            writes.push_back({false, std::string(reinterpret_cast<const char *>(data), length)});
+        };
+        transport.capabilities = {LINK_ATT_MTU, LINK_QUEUE_DEPTH, params.interval_us};
+        if (connection_profile) {
+            transport.set_connection_profile = [this](const connection_profile_t &profile,
+                                                      connection_profile_t *previous) {
+                std::lock_guard<std::mutex> guard(mutex);
+                if (previous) {
+                    *previous = {params.interval_us, params.interval_us, 0, 0, params.phy_2m, params.data_length};
+                }
+                pending = params;
+                if (profile.max_interval_us) {
+                    pending.interval_us = profile.max_interval_us;
+                }
+                pending.phy_2m = profile.phy_2m;
+                if (profile.data_length) {
+                    pending.data_length = profile.data_length;
+                }
+                update_events = CONNECTION_UPDATE_EVENTS;
+                return true;
+            };
+        }
+        return transport;
+    }
+
+    void start(NrfDfuServer &server) {
+        radio = std::thread([this, &server] { connection_events(server); });
+    }
+
+  private:
+    struct write_t {
+        bool command;
+        std::string data;
+    };
+
+    void connection_events(NrfDfuServer &server) {
+        auto event = std::chrono::steady_clock::now();
+        while (!stop) {
+            std::vector<std::string> received;
+            std::vector<write_t> sent;
+            {
+                std::lock_guard<std::mutex> guard(mutex);
+                if (update_events && --update_events == 0) {
+                    params = pending;
+                }
+                double budget_us = params.interval_us * EVENT_LENGTH_PERCENT / 100.0;
+                // Notifications from the last event first, then as many writes as still fit
+                while (!notifications.empty() && budget_us >= airtime_us(notifications.front().size(), params)) {
+                    budget_us -= airtime_us(notifications.front().size(), params);
+                    received.push_back(notifications.front());
+                    notifications.pop_front();
+                }
+                while (!writes.empty() && budget_us >= airtime_us(writes.front().data.size(), params)) {
+                    budget_us -= airtime_us(writes.front().data.size(), params);
+                    sent.push_back(writes.front());
+                    writes.pop_front();
+                }
+            }
+
+            uint16_t commands = 0;
+            for (const write_t &write : sent) {
+                if (write.command) {
+                    bootloader.packet(write.data);
+                    commands++;
+                } else {
+                    bootloader.request(write.data);
+                }
+            }
+            if (commands) {
+                server.add_write_credits(commands);
+            }
+            for (const std::string &notification : received) {
+                server.notify(DFU_CONTROL_POINT, reinterpret_cast<const uint8_t *>(notification.data()),
+                              notification.size());
+            }
+
+            event += std::chrono::microseconds(params.interval_us);
+            std::this_thread::sleep_until(event);
+        }
+    }
+
+    link_params_t params;
+    link_params_t pending = {};
+    uint32_t update_events = 0;
+    EmulatedBootloader &bootloader;
+    std::mutex mutex;
+    std::deque<write_t> writes;
+    std::deque<std::string> notifications;  // Only touched on the link thread
+    std::atomic<bool> stop{false};
+    std::thread radio;
+};
+
+// One DFU over an emulated link connected with power saving parameters. Returns the transfer time in seconds.
+static double run_dfu(const std::string &data_file, const std::string &image, bool connection_profile, bool &ok) {
+    EmulatedBootloader bootloader;
+    bootloader.image_size = image.size();
+    EmulatedLink link({POWER_SAVING_INTERVAL_US, false, LEGACY_DATA_LENGTH}, bootloader);
+    NrfDfuServer server(link.transport(connection_profile), data_file, image);
+    server.set_pipelining(true);
+
+    auto start = std::chrono::steady_clock::now();
+    link.start(server);
+    server.run_dfu();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    ok = (server.get_state() == DFU_FINISHED) && bootloader.finished;
+    return seconds;
+}
+
+/**
+ * main
+ *
+ * Measures the DFU transfer time over an emulated BLE link, connected with power saving parameters, with and without
+ * the bulk transfer connection profile requested by NrfDfuServer.
+ * Usage: dfu_link_bench [image_size]
+ *      -image_size: Bin file size, in bytes (default 128 KiB)
+ *
+ */
+int main(int argc, char *argv[]) {
+    size_t image_size = (argc > 1) ? std::strtoull(argv[1], nullptr, 10) : DEFAULT_IMAGE_SIZE;
+    if (image_size == 0) {
+        std::cout << "Usage: " << argv[0] << " [image_size]" << std::endl;
+        return -1;
+    }
+
+    std::string data_file(DATA_FILE_SIZE, '\0');
+    std::string image(image_size, '\0');
+    unsigned int seed = 1;
+    for (auto &byte : image) {
+        seed = seed * 1103515245u + 12345u;
+        byte = static_cast<char>(seed >> 16);
+    }
+
+    std::cout << "Emulated link: " << POWER_SAVING_INTERVAL_US / 1000.0 << " ms interval, 1M PHY, "
+              << LEGACY_DATA_LENGTH << " byte LL PDUs. Bulk profile: " << BULK_CONNECTION_INTERVAL_US / 1000.0
+              << " ms interval, 2M PHY, " << BULK_DATA_LENGTH << " byte LL PDUs" << std::endl;
+    std::cout << std::left << std::setw(20) << "profile" << std::right << std::setw(12) << "time (s)"
+              << std::setw(12) << "kB/s" << std::setw(8) << "ok" << std::endl;
+
+    double seconds[2];
+    for (bool connection_profile : {false, true}) {
+        bool ok = false;
+        seconds[connection_profile] = run_dfu(data_file, image, connection_profile, ok);
+        std::cout << std::left << std::setw(20) << (connection_profile ? "bulk transfer" : "connection default")
+                  << std::right << std::fixed << std::setprecision(2) << std::setw(12) << seconds[connection_profile]
+                  << std::setw(12) << image_size / seconds[connection_profile] / 1000 << std::setw(8)
+                  << (ok ? "yes" : "NO") << std::endl;
+    }
+    std::cout << "Speedup: " << std::setprecision(1) << seconds[0] / seconds[1] << "x" << std::endl;
+    return 0;
+}
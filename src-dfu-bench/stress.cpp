@@ -0,0 +1,387 @@
+#include "NrfDfuServer.h"
+#include "emulated_bootloader.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace NativeDFU;
+
+#define DEFAULT_SESSIONS 64
+#define DEFAULT_ROUNDS 4
+#define IMAGE_SIZE (24 * 1024 + 123)  // Not a multiple of the object or packet size
+#define DATA_FILE_SIZE 141
+#define LOOPBACK_ATT_MTU 247
+#define LOOPBACK_QUEUE_DEPTH 8
+#define LOOPBACK_DROP_EVERY 53  // Packets, for the sessions that lose some
+#define SCENARIO_RESPONSE_TIMEOUT_MS 100
+
+// Writes go straight to an emulated bootloader. Threaded, a responder thread takes them off a queue, sends the
+// responses and gives the write credits back, like a BLE stack would. Otherwise all of it happens inside the write
+// callbacks, on the thread running the FSM.
+class LoopbackTransport {
+  public:
+    LoopbackTransport(EmulatedBootloader &bootloader, bool threaded) : bootloader(bootloader), threaded(threaded) {}
+
+    ~LoopbackTransport() {
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            stop = true;
+        }
+        cv.notify_all();
+        if (responder.joinable()) {
+            responder.join();
+        }
+    }
+
+    dfu_transport_t transport(bool credits) {
+        dfu_transport_t transport;
+        transport.write_command = [this](dfu_characteristic_t, const uint8_t *data, size_t length) {
+            write(true, std::string(reinterpret_cast<const char *>(data), length));
+        };
+        transport.write_request = [this](dfu_characteristic_t, const uint8_t *data, size_t length) {
+            write(false, std::string(reinterpret_cast<const char *>(data), length));
+        };
+        transport.capabilities = capabilities(credits);
+        return transport;
+    }
+
+    static transport_capabilities_t capabilities(bool credits) {
+        return {LOOPBACK_ATT_MTU, static_cast<uint16_t>(credits ? LOOPBACK_QUEUE_DEPTH : 0), 0};
+    }
+
+    template <class Server>
+    void start(Server &dfu_server) {
+        bootloader.notify = [&dfu_server](const std::string &data) {
+            dfu_server.notify(DFU_CONTROL_POINT, reinterpret_cast<const uint8_t *>(data.data()), data.size());
+        };
+        add_write_credits = [&dfu_server](uint16_t packets) { dfu_server.add_write_credits(packets); };
+        if (threaded) {
+            responder = std::thread([this] { respond(); });
+        }
+    }
+
+    void write(bool command, std::string data) {
+        if (!threaded) {
+            deliver({command, std::move(data)});
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            writes.push_back({command, std::move(data)});
+        }
+        cv.notify_one();
+    }
+
+  private:
+    struct write_t {
+        bool command;
+        std::string data;
+    };
+
+    void deliver(const write_t &write) {
+        if (write.command) {
+            bootloader.packet(write.data);
+            add_write_credits(1);
+        } else {
+            bootloader.request(write.data);
+        }
+    }
+
+    void respond() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            cv.wait(lock, [this] { return stop || !writes.empty(); });
+            if (stop) {
+                return;
+            }
+            write_t write = std::move(writes.front());
+            writes.pop_front();
+            lock.unlock();
+            deliver(write);
+            lock.lock();
+        }
+    }
+
+    EmulatedBootloader &bootloader;
+    bool threaded;
+    std::function<void(uint16_t)> add_write_credits;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<write_t> writes;
+    bool stop = false;
+    std::thread responder;
+};
+
+// Transport policy writing to the loopback without going through std::function, for BasicDfuServer
+class LoopbackPolicy {
+  public:
+    LoopbackPolicy(LoopbackTransport &loopback, bool credits) : loopback(&loopback), credits(credits) {}
+
+    void write_command(dfu_characteristic_t, const uint8_t *data, size_t length) {
+        loopback->write(true, std::string(reinterpret_cast<const char *>(data), length));
+    }
+
+    void write_request(dfu_characteristic_t, const uint8_t *data, size_t length) {
+        loopback->write(false, std::string(reinterpret_cast<const char *>(data), length));
+    }
+
+    bool batches_writes() const { return false; }
+
+    void write_command_batch(dfu_characteristic_t, const packet_view_t *, size_t) {}
+
+    transport_capabilities_t capabilities() const { return LoopbackTransport::capabilities(credits); }
+
+    bool set_connection_profile(const connection_profile_t &, connection_profile_t *) { return false; }
+
+  private:
+    LoopbackTransport *loopback;
+    bool credits;
+};
+
+struct session_t {
+    EmulatedBootloader bootloader;
+    std::unique_ptr<NrfDfuServer> server;  // Or direct_server, over the transport policy
+    std::unique_ptr<BasicDfuServer<LoopbackPolicy>> direct_server;
+    std::unique_ptr<LoopbackTransport> loopback;  // Stopped first, its responder thread notifies the server
+
+    // Calls function with whichever server the session runs
+    template <class Function>
+    void with_server(Function function) {
+        if (server) {
+            function(*server);
+        } else {
+            function(*direct_server);
+        }
+    }
+};
+
+// Every combination of flow control, threading, write credits, packet loss and server type is run by some session
+static void configure(session_t &session, unsigned int index, const std::string &data_file, const std::string &image) {
+    bool threaded = (index / 4) % 2;
+    bool credits = (index / 8) % 2;
+    session.bootloader.image_size = image.size();
+    session.bootloader.drop_every = ((index / 16) % 2) ? LOOPBACK_DROP_EVERY : 0;
+    session.loopback.reset(new LoopbackTransport(session.bootloader, threaded));
+    if ((index / 32) % 2) {
+        LoopbackPolicy policy(*session.loopback, credits);
+        session.direct_server.reset(new BasicDfuServer<LoopbackPolicy>(policy, data_file, image));
+    } else {
+        session.server.reset(new NrfDfuServer(session.loopback->transport(credits), data_file, image));
+    }
+
+    session.with_server([index](auto &server) {
+        switch (index % 4) {
+            case 1:
+                server.set_pipelining(true);
+                break;
+
+            case 2:
+                server.set_prn_window(8);
+                break;
+
+            case 3:
+                server.set_adaptive_window(32);
+                break;
+
+            default:
+                break;
+        }
+    });
+}
+
+// * Fault scenarios: how the bootloader is set up and the state the DFU must end in
+struct scenario_t {
+    const char *name;
+    bool pipelining;
+    std::function<void(EmulatedBootloader &)> setup;
+    state_t expected;
+};
+
+static std::vector<scenario_t> fault_scenarios(const std::string &data_file, const std::string &image) {
+    std::string corrupted = image.substr(0, 3 * BOOTLOADER_DATA_MAX / 2);
+    corrupted.back() ^= 1;
+    auto resume = [&data_file, &image](uint32_t received, uint32_t executed) {
+        return [&data_file, &image, received, executed](EmulatedBootloader &bootloader) {
+            bootloader.preload(data_file, image.substr(0, received), executed);
+        };
+    };
+    auto fail = [](uint8_t opcode, uint32_t nth) {
+        return [opcode, nth](EmulatedBootloader &bootloader) { bootloader.fail_request[opcode] = nth; };
+    };
+    auto drop = [](uint8_t opcode, uint32_t nth) {
+        return [opcode, nth](EmulatedBootloader &bootloader) { bootloader.drop_response[opcode] = nth; };
+    };
+    // Objects that don't end on flash pages: the server falls back to its running CRC between page CRCs
+    auto object_max = [](uint32_t size) {
+        return [size](EmulatedBootloader &bootloader) { bootloader.data_object_max = size; };
+    };
+
+    return {
+        {"resume inside an object", false, resume(2 * BOOTLOADER_DATA_MAX + 100, 2 * BOOTLOADER_DATA_MAX),
+         DFU_FINISHED},
+        {"resume at an executed object", false, resume(2 * BOOTLOADER_DATA_MAX, 2 * BOOTLOADER_DATA_MAX),
+         DFU_FINISHED},
+        {"resume at an executed object, pipelined", true, resume(2 * BOOTLOADER_DATA_MAX, 2 * BOOTLOADER_DATA_MAX),
+         DFU_FINISHED},
+        {"resume with the data file execute failing", false,
+         [&data_file, &image](EmulatedBootloader &bootloader) {
+             bootloader.preload(data_file, image.substr(0, BOOTLOADER_DATA_MAX), BOOTLOADER_DATA_MAX);
+             bootloader.fail_request[EXECUTE_KEY] = 1;
+         },
+         DFU_ERROR},
+        {"resume at an executed object, execute failing", false,
+         [&data_file, &image](EmulatedBootloader &bootloader) {
+             bootloader.preload(data_file, image.substr(0, 2 * BOOTLOADER_DATA_MAX), 2 * BOOTLOADER_DATA_MAX);
+             bootloader.fail_request[EXECUTE_KEY] = 2;
+         },
+         DFU_ERROR},
+        {"resume at a complete object", false, resume(2 * BOOTLOADER_DATA_MAX, BOOTLOADER_DATA_MAX), DFU_FINISHED},
+        {"resume with another image", false,
+         [&data_file, corrupted](EmulatedBootloader &bootloader) {
+             bootloader.preload(data_file, corrupted, BOOTLOADER_DATA_MAX);
+         },
+         DFU_FINISHED},
+        {"select response lost", false, drop(SELECT_OBJECT_KEY, 1), DFU_FINISHED},
+        {"checksum response lost", false, drop(CALCULATE_CHECKSUM_KEY, 2), DFU_FINISHED},
+        {"create response lost", false, drop(CREATE_KEY, 2), DFU_ERROR_TIMEOUT},
+        {"execute failed, pipelined", true, fail(EXECUTE_KEY, 3), DFU_FINISHED},
+        {"create after execute failed, pipelined", true, fail(CREATE_KEY, 3), DFU_FINISHED},
+        {"1024 byte objects", false, object_max(1024), DFU_FINISHED},
+        {"3000 byte objects", false, object_max(3000), DFU_FINISHED},
+        {"3000 byte objects, pipelined", true, object_max(3000), DFU_FINISHED},
+        {"3000 byte objects, resume inside an object", false,
+         [&data_file, &image](EmulatedBootloader &bootloader) {
+             bootloader.data_object_max = 3000;
+             bootloader.preload(data_file, image.substr(0, 2 * 3000 + 100), 2 * 3000);
+         },
+         DFU_FINISHED},
+    };
+}
+
+// Runs each fault scenario once on its own, with the page CRCs of the image precomputed as dfu_app does. Returns the
+// number that ended in another state than expected.
+static unsigned int run_fault_scenarios(const std::string &data_file, const std::string &image) {
+    unsigned int failed = 0;
+    std::vector<uint32_t> page_crcs((image.size() + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE);
+    crcPrefixTable(reinterpret_cast<const unsigned char *>(image.data()), image.size(), FLASH_PAGE_SIZE,
+                   page_crcs.data(), 1);
+    for (const scenario_t &scenario : fault_scenarios(data_file, image)) {
+        EmulatedBootloader bootloader;
+        bootloader.image_size = image.size();
+        bootloader.strict_execute = true;
+        scenario.setup(bootloader);
+        std::unique_ptr<LoopbackTransport> loopback(new LoopbackTransport(bootloader, true));
+        NrfDfuServer server(loopback->transport(false), data_file, image, page_crcs);
+        server.set_pipelining(scenario.pipelining);
+        for (uint8_t opcode = CREATE_KEY; opcode <= DFU_ABORT_KEY; opcode++) {
+            server.set_response_timeout(static_cast<op_code_t>(opcode),
+                                        std::chrono::milliseconds(SCENARIO_RESPONSE_TIMEOUT_MS));
+        }
+
+        loopback->start(server);
+        server.run_dfu();
+        loopback.reset();
+        state_t state = server.get_state();
+        bool finished = (scenario.expected == DFU_FINISHED);
+        if (state != scenario.expected || bootloader.finished != finished) {
+            std::cout << "Scenario \"" << scenario.name << "\" ended in state " << state << ", expected "
+                      << scenario.expected << std::endl;
+            failed++;
+        }
+    }
+    return failed;
+}
+
+/**
+ * main
+ *
+ * Runs many DFU sessions at once, each server on its own thread against a loopback transport, while another thread
+ * polls their state. Half of them are NrfDfuServer, the others BasicDfuServer calling the loopback directly. Meant to
+ * be built with -DSANITIZE_THREAD=ON, so ThreadSanitizer reports any data race between the FSM, notification and
+ * transport threads or between sessions. The fault scenarios, resumed DFUs and lost or failed responses, run after.
+ * Returns non-zero if any session or scenario doesn't end as expected.
+ * Usage: dfu_stress [sessions] [rounds]
+ *      -sessions: Servers running at the same time (default 64)
+ *      -rounds: Times the sessions are started over (default 4)
+ *
+ */
+int main(int argc, char *argv[]) {
+    unsigned int sessions = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : DEFAULT_SESSIONS;
+    unsigned int rounds = (argc > 2) ? std::strtoul(argv[2], nullptr, 10) : DEFAULT_ROUNDS;
+    if (sessions == 0 || rounds == 0) {
+        std::cout << "Usage: " << argv[0] << " [sessions] [rounds]" << std::endl;
+        return -1;
+    }
+
+    std::string data_file(DATA_FILE_SIZE, '\x5A');
+    std::string image(IMAGE_SIZE, '\0');
+    unsigned int seed = 1;
+    for (auto &byte : image) {
+        seed = seed * 1103515245u + 12345u;
+        byte = static_cast<char>(seed >> 16);
+    }
+
+    unsigned int passed = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned int round = 0; round < rounds; round++) {
+        std::vector<session_t> session(sessions);
+        for (unsigned int index = 0; index < sessions; index++) {
+            configure(session[index], index, data_file, image);
+        }
+
+        std::atomic<unsigned int> running(sessions);
+        std::vector<std::thread> threads;
+        for (session_t &s : session) {
+            threads.emplace_back([&s, &running] {
+                s.with_server([&s](auto &server) {
+                    s.loopback->start(server);
+                    server.run_dfu();
+                });
+                running--;
+            });
+        }
+        // Progress is read from another thread, as an application showing it would
+        while (running) {
+            for (session_t &s : session) {
+                s.with_server([](auto &server) {
+                    server.get_state();
+                    server.get_link_stats();
+                    server.get_packet_size();
+                });
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        for (std::thread &thread : threads) {
+            thread.join();
+        }
+
+        for (unsigned int index = 0; index < sessions; index++) {
+            session[index].loopback.reset();
+            state_t state = DFU_IDLE;
+            session[index].with_server([&state](auto &server) { state = server.get_state(); });
+            if (state == DFU_FINISHED && session[index].bootloader.finished) {
+                passed++;
+            } else {
+                std::cout << "Round " << round << " session " << index << " ended in state " << state << std::endl;
+            }
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << passed << "/" << sessions * rounds << " sessions finished in " << seconds << " s" << std::endl;
+
+    unsigned int scenarios = fault_scenarios(data_file, image).size();
+    unsigned int failed = run_fault_scenarios(data_file, image);
+    std::cout << scenarios - failed << "/" << scenarios << " fault scenarios ended as expected" << std::endl;
+    return (passed == sessions * rounds && failed == 0) ? 0 : 1;
+}
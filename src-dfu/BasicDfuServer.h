@@ -0,0 +1,809 @@
+#pragma once
+
+#include "NrfDfuServerTypes.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace NativeDFU {
+
+// * CRC32 as computed by the bootloader. Defined in NrfDfuServer.cpp, so crc.h is not needed by the installed headers
+uint32_t dfu_crc(const char *data, size_t length);
+uint32_t dfu_crc_start();
+uint32_t dfu_crc_update(uint32_t remainder, const char *data, size_t length);
+uint32_t dfu_crc_finalize(uint32_t remainder);
+uint32_t dfu_crc_combine(uint32_t crc_a, uint32_t crc_b, size_t length_b);
+
+// * Selects the state_action and state_event overloads of a state at compile time
+template <state_t S>
+using fsm_state_tag = std::integral_constant<state_t, S>;
+
+/**
+ * BasicDfuServer
+ *
+ * DFU server calling the member functions of its Transport directly, so they can be inlined into the FSM. The
+ * transport is held by value, a policy for a transport owned elsewhere holds a pointer to it. Transport must provide:
+ *      -void write_command(dfu_characteristic_t characteristic, const uint8_t *data, size_t length)
+ *      -void write_request(dfu_characteristic_t characteristic, const uint8_t *data, size_t length)
+ *      -bool batches_writes(): True to have the packets of a burst written with write_command_batch
+ *      -void write_command_batch(dfu_characteristic_t characteristic, const packet_view_t *packets, size_t count)
+ *      -transport_capabilities_t capabilities(): Read once, by the constructor
+ *      -bool set_connection_profile(const connection_profile_t &profile, connection_profile_t *previous): False if
+ *      the profile can't be changed, see ble_connection_profile_t
+ * All of them are called on the thread running run_dfu. NrfDfuServer is the instantiation over std::function
+ * callbacks.
+ */
+template <class Transport>
+class BasicDfuServer {
+  public:
+    /**
+     * BasicDfuServer::BasicDfuServer()
+     *
+     * Constructor, will initialize variables. The ATT MTU in the transport's capabilities sets the packet size as
+     * set_mtu, a write queue depth makes the server hold write credits (see add_write_credits) and the connection
+     * interval stretches the receipt timeout on slow links.
+     *
+     * @param transport_p: Transport policy, see above
+     * @param datafile_data_r: [in] String containing the datafile DATA used for DFU. // !THIS IS NOT THE PATH
+     * @param binfile_data_r: [in] String containing the binfile DATA used for DFU. // !THIS IS NOT THE PATH
+     * @param bin_page_crcs_r: [in] CRC32 of the first min((i + 1) * FLASH_PAGE_SIZE, bin size) bytes of the bin file at
+     * index i. Missing entries are calculated from the bin file.
+     */
+    BasicDfuServer(Transport transport_p, const std::string &datafile_data_r, const std::string &binfile_data_r,
+                   const std::vector<uint32_t> &bin_page_crcs_r = std::vector<uint32_t>());
+
+    /**
+     * BasicDfuServer::run_dfu
+     *
+     * Public method, will carry out the whole DFU process. Abstracting the user from internal functionality. If the
+     * transport can set the connection profile, the bulk transfer profile is in force for the duration of the DFU and
+     * the previous profile is restored afterwards. Servers share no state: any number of them can run at once, each
+     * on its own thread.
+     *
+     */
+    void run_dfu();
+
+    /**
+     * BasicDfuServer::notify
+     *
+     * This function notifies the FSM of a BLE package reception. The raw data is processed and saved in
+     * control_point_response_t response;
+     *
+     * @param service: BLE service & characteristic which sent data
+     * @param characteristic: BLE service & characteristic which sent data
+     * @param data: Raw data received via BLE
+     */
+    void notify(std::string service, std::string characteristic, std::string data);
+
+    /**
+     * BasicDfuServer::notify
+     *
+     * Same as the notify method above, with the characteristic already resolved to a handle. Safe to call from any
+     * thread, also from within the write callbacks of a loopback transport, but not from two threads at once. The
+     * response is handed to the FSM through a lock-free ring, the mutex is only taken to wake it up. Never blocks:
+     * notifications arriving while run_dfu isn't running are ignored, and ones finding the ring full are dropped and
+     * counted in link_stats_t::responses_dropped.
+     *
+     * @param characteristic: DFU characteristic which sent data
+     * @param data: Raw data received via BLE
+     * @param length: Length of the data
+     */
+    void notify(dfu_characteristic_t characteristic, const uint8_t *data, size_t length);
+
+    /**
+     * BasicDfuServer::resolve_characteristic
+     *
+     * Resolves a service & characteristic UUID pair to its DFU characteristic handle. Meant to be called once when
+     * setting up the transport, not on every packet.
+     *
+     * @param service: BLE service UUID
+     * @param characteristic: BLE characteristic UUID
+     * @return dfu_characteristic_t: The handle, DFU_UNKNOWN_CHAR if not a DFU characteristic
+     */
+    static dfu_characteristic_t resolve_characteristic(const std::string &service, const std::string &characteristic);
+
+    /**
+     * BasicDfuServer::characteristic_uuid
+     *
+     * Returns the UUID of a DFU characteristic handle.
+     *
+     * @param characteristic: DFU characteristic handle
+     * @return const std::string &: The characteristic UUID, empty for DFU_UNKNOWN_CHAR
+     */
+    static const std::string &characteristic_uuid(dfu_characteristic_t characteristic);
+
+    /**
+     * BasicDfuServer::service_uuid
+     *
+     * Returns the UUID of the DFU service.
+     *
+     * @return const std::string &: The service UUID
+     */
+    static const std::string &service_uuid();
+
+    /**
+     * BasicDfuServer::set_pipelining
+     *
+     * Optional: enables request pipelining for the bin file. The bootloader handles control point requests in order, so
+     * a data object's create request, packets and checksum request are sent back to back, and once its checksum is
+     * verified its execute request is followed right away by the next object. Responses are matched to the requests
+     * in order, which saves two round trips per object. Disabled by default. Must be called before run_dfu.
+     *
+     * @param enable: True to pipeline requests
+     */
+    void set_pipelining(bool enable);
+
+    /**
+     * BasicDfuServer::set_prn_window
+     *
+     * Optional: enables packet receipt notification (PRN) flow control. The server keeps at most packets packets in
+     * flight, the device is asked for a receipt with its offset and CRC every packets / 2 packets and each receipt lets
+     * the next half window go. A receipt with an unexpected offset or CRC, or none within PRN_RECEIPT_TIMEOUT_MS, means
+     * packets were lost: the object stops early and what is missing is resent. 0 (default) disables receipts. Must be
+     * called before run_dfu.
+     *
+     * @param packets: Maximum number of packets in flight
+     */
+    void set_prn_window(uint16_t packets);
+
+    /**
+     * BasicDfuServer::set_adaptive_window
+     *
+     * Optional: PRN flow control as set_prn_window, with the window adapted to the link (AIMD). It starts at
+     * PACING_INITIAL_WINDOW packets and grows by one packet per window of receipts that match, up to max_packets. Lost
+     * packets halve it, down to PACING_MIN_WINDOW. The receipt interval follows the window from one object to the next.
+     * 0 (default) disables it. Must be called before run_dfu.
+     *
+     * @param max_packets: Maximum number of packets in flight
+     */
+    void set_adaptive_window(uint16_t max_packets);
+
+    /**
+     * BasicDfuServer::get_link_stats
+     *
+     * Getter returns the throughput, window and losses measured with packet receipt notifications. Safe to call from
+     * any thread while run_dfu runs.
+     *
+     * @return link_stats_t: The link statistics, throughput stays 0 without receipts
+     */
+    link_stats_t get_link_stats();
+
+    /**
+     * BasicDfuServer::add_write_credits
+     *
+     * Called by the transport when its queue has room for more write commands, with a write queue depth in its
+     * capabilities. Can be called from any thread.
+     *
+     * @param packets: Number of write commands that left the queue
+     */
+    void add_write_credits(uint16_t packets);
+
+    /**
+     * BasicDfuServer::set_response_timeout
+     *
+     * Optional: time the device has to answer requests with the given opcode, counted from when the FSM starts waiting
+     * for the response. Defaults to CREATE_RESPONSE_TIMEOUT_MS for CREATE, EXECUTE_RESPONSE_TIMEOUT_MS for EXECUTE and
+     * RESPONSE_TIMEOUT_MS for the others. Once it expires, and any retries are spent, the DFU ends in
+     * DFU_ERROR_TIMEOUT. With pipelining and large objects, the checksum is only answered once all the packets before
+     * it are sent. Must be called before run_dfu.
+     *
+     * @param opcode: Request opcode
+     * @param timeout: Time to wait for the response, std::chrono::milliseconds::max() to wait forever
+     */
+    void set_response_timeout(op_code_t opcode, std::chrono::milliseconds timeout);
+
+    /**
+     * BasicDfuServer::set_request_retries
+     *
+     * Optional: times a request that is safe to repeat (CALCULATE_CHECKSUM, SELECT, PRN value, MTU_GET) is sent again
+     * when its response times out, MAX_REQUEST_RETRIES by default. Only done when no other request is waiting for a
+     * response, so the responses can't come out of order. Must be called before run_dfu.
+     *
+     * @param retries: Resends per request, 0 to fail on the first timeout
+     */
+    void set_request_retries(uint8_t retries);
+
+    /**
+     * BasicDfuServer::set_bulk_profile
+     *
+     * Optional: replaces the connection profile requested from the transport during run_dfu. The default asks for a
+     * BULK_CONNECTION_INTERVAL_US interval, no peripheral latency, 2M PHY and BULK_DATA_LENGTH bytes LL PDUs.
+     *
+     * @param profile: Connection profile for the DFU
+     */
+    void set_bulk_profile(const connection_profile_t &profile);
+
+    /**
+     * BasicDfuServer::set_mtu
+     *
+     * Optional: sets the ATT MTU negotiated by the transport. DFU packets, for the data file and the bin file alike,
+     * carry up to att_mtu - ATT_HEADER_LEN bytes, MTU_CHUNK if not set. The MTU reported by the device to MTU_GET, if
+     * any, can only lower it. Must be called before run_dfu.
+     *
+     * @param att_mtu: ATT MTU of the link, at least ATT_MTU_MIN
+     */
+    void set_mtu(uint16_t att_mtu);
+
+    /**
+     * BasicDfuServer::get_packet_size
+     *
+     * Getter returns the payload of a DFU packet write. Final once the FSM is past GET_MTU. Safe to call from any
+     * thread while run_dfu runs.
+     *
+     * @return uint16_t: Bytes per DFU packet
+     */
+    uint16_t get_packet_size();
+
+    /**
+     * BasicDfuServer::get_state
+     *
+     * Getter returns the current state of the FSM. Safe to call from any thread while run_dfu runs.
+     *
+     * @return state_t: The current of the FSM
+     */
+    state_t get_state();
+
+  private:
+    // * Request waiting for a response, see expected_opcodes
+    struct expected_response_t {
+        uint8_t opcode;
+        bool internal;        // Sent by the server itself, not handed to state_event
+        std::string request;  // Opcode and parameters, to send it again
+        uint8_t retries;
+    };
+
+    // * Response parsed by notify, on its way to the FSM
+    struct queued_response_t {
+        event_t event;
+        control_point_response_t response;
+    };
+
+    // * Methods to send necessary data for DFU handshake
+
+    /**
+     * BasicDfuServer::set_pck_notif_value
+     *
+     * Sets number of packages to receive before generating a notification. THe DFU default value is 0, just incase call
+     * this function before carrying out any DFU operation
+     *
+     * @param num_pcks: Number of packages to receive before generating a notification
+     * @param internal: True if the response is consumed by the server itself, see write_procedure
+     */
+    void set_pck_notif_value(uint16_t num_pcks, bool internal = false);
+
+    /**
+     * BasicDfuServer::select_object
+     *
+     * Selects the last object with the given type that was sent. The response holds the maximum object size, used to
+     * size data objects, and the offset and CRC of what the device already received, used to continue with a DFU
+     * interrupted by a power down or disconnection.
+     *
+     * @param obj_type: Defines the type of object to be create, can be command or data object
+     */
+    void select_object(object_type_t obj_type);
+
+    /**
+     * BasicDfuServer::get_mtu
+     *
+     * Requests the MTU of the device. Bootloaders on BLE report 0 and leave it to the ATT MTU of the link, serial ones
+     * report their buffer size. Not sent when the transport reports its ATT MTU in transport_capabilities_t.
+     *
+     */
+    void get_mtu();
+
+    /**
+     * BasicDfuServer::write_create_request
+     *
+     * Carries out a Create Procedure: Create an object with the given type and selects it. Removes an old object of the
+     * same type (if such an object exists).
+     *
+     * @param obj_type: Defines the type of object to be create, can be command or data object
+     * @param size: Object size in little endian
+     */
+    void write_create_request(object_type_t obj_type, uint32_t size);
+
+    /**
+     * BasicDfuServer::write_packet
+     *
+     * Writes to the DFU Packet Characteristic. This characteristic receives data for Device Firmware Updates as DFU
+     * packets.
+     *
+     * @param data: Bytes to send
+     * @param length: Number of bytes to send
+     */
+    void write_packet(const char *data, size_t length);
+
+    /**
+     * BasicDfuServer::write_packets
+     *
+     * Splits data in packet_size sized packets and writes them to the DFU Packet Characteristic, in a single call to
+     * write_command_batch if the transport batches writes. With a PRN window, waits for the receipt after every
+     * prn_window packets and stops early if packets were lost.
+     *
+     * @param data: Bytes to send
+     * @param length: Number of bytes to send
+     * @param offset: Offset of data in the object, as reported by the device
+     */
+    void write_packets(const char *data, size_t length, uint32_t offset);
+
+    /**
+     * BasicDfuServer::wait_receipt
+     *
+     * Waits for the oldest packet receipt notification still due and takes it out of the responses. It follows the
+     * responses to the requests waiting in expected_opcodes, which are left in place. Stale receipts and duplicates
+     * are dropped on the way, as next_response would.
+     *
+     * @param expected: Offset and CRC the device should report
+     * @return bool: False if the receipt doesn't match or didn't arrive within this->receipt_timeout
+     */
+    bool wait_receipt(const packet_receipt_t &expected);
+
+    /**
+     * BasicDfuServer::resync_receipts
+     *
+     * Called when packets were lost: sets the PRN value again, which restarts the device's packet count, and drops the
+     * receipts still in flight until it is answered.
+     *
+     */
+    void resync_receipts();
+
+    /**
+     * BasicDfuServer::prn_interval
+     *
+     * Returns the number of packets between two receipt notifications.
+     *
+     * @return uint32_t: Packets per receipt
+     */
+    uint32_t prn_interval();
+
+    /**
+     * BasicDfuServer::take_write_credits
+     *
+     * Waits until the transport has room for at least one write command, up to WRITE_CREDIT_TIMEOUT_MS, and takes
+     * credits for as many packets as fit. Returns packets right away without a write queue depth.
+     *
+     * @param packets: Number of packets to write
+     * @return uint32_t: Number of packets that can be written now, 0 if the transport stayed full
+     */
+    uint32_t take_write_credits(uint32_t packets);
+
+    /**
+     * BasicDfuServer::receipt_received
+     *
+     * With an adaptive window, grows the window after a receipt that matched.
+     *
+     */
+    void receipt_received();
+
+    /**
+     * BasicDfuServer::measure_throughput
+     *
+     * Updates the smoothed throughput in this->link_stats.
+     *
+     * @param bytes: Bytes confirmed by receipts during a write_packets call
+     * @param elapsed: Time from its first packet to its last receipt
+     */
+    void measure_throughput(uint32_t bytes, std::chrono::steady_clock::duration elapsed);
+
+    /**
+     * BasicDfuServer::packets_lost
+     *
+     * Counts a loss and, with an adaptive window, halves the window.
+     *
+     */
+    void packets_lost();
+
+    /**
+     * BasicDfuServer::request_checksum
+     *
+     * Requests the checksum of the current object. The checksum is reset after sending an Execute command.
+     * IMPORTANT: Checksum will be carried on the WHOLE object. For example on the bin file the checksum will be carried
+     * on all the FLASH_PAGES received NOT ONLY THE LAST ONE.
+     *
+     */
+    void request_checksum();
+
+    /**
+     * BasicDfuServer::write_execute
+     *
+     * Executes the last object that was sent. This must be called after sending data and validating received checksum.
+     * Must also be called after last bin file data
+     *
+     */
+    void write_execute();
+
+    /**
+     * BasicDfuServer::write_procedure
+     *
+     * Writes to the DFU Control Point Characteristic. This characteristic is used to control the state of
+     * the DFU process. All DFU procedures are requested by writing to this characteristic. The opcode is queued in
+     * this->expected_opcodes, the next response must answer it.
+     *
+     * @param opcode: String containing [Control Point OPCODE] + [Control Point Parameters] (optional)
+     * @param response: False if the device will not respond to this request
+     * @param internal: True if the response is consumed by next_response instead of being handed to state_event
+     */
+    void write_procedure(const std::string &opcode_parameters, bool response = true, bool internal = false);
+
+    // * Methods to Handle FSM
+
+    /**
+     * BasicDfuServer::run
+     *
+     * Internal function which runs one step of the FSM. Calls the action and the event handler of the current state
+     * through fsm_table, waiting for a response if necessary. Ends the DFU in DFU_ERROR_TIMEOUT if a response didn't
+     * arrive in time.
+     *
+     */
+    void run();
+
+    /**
+     * BasicDfuServer::fsm_action
+     *
+     * Entry of fsm_table for the action of state S: calls the state_action overload of S.
+     *
+     */
+    template <state_t S>
+    void fsm_action();
+
+    /**
+     * BasicDfuServer::fsm_event
+     *
+     * Entry of fsm_table for the event handler of state S: calls the state_event overload of S.
+     *
+     */
+    template <state_t S>
+    void fsm_event();
+
+    /**
+     * BasicDfuServer::state_action
+     *
+     * Action of a state, carried out on entering it. Every request expecting a response is recorded in
+     * this->expected_opcodes by write_procedure, run() then waits until all of them are answered before calling
+     * state_event. Overloaded for every state that sends something, the template does nothing.
+     *
+     * IMPORTANT: The notify method will be called asynchronous on a thread. Responses are queued on the response ring,
+     * so a response arriving before the action returns is not lost.
+     */
+    template <state_t S>
+    void state_action(fsm_state_tag<S>);
+    void state_action(fsm_state_tag<SET_NOTIF_VALUE>);
+    void state_action(fsm_state_tag<GET_MTU>);
+    void state_action(fsm_state_tag<DATAFILE_SELECT_COM_OBJ>);
+    void state_action(fsm_state_tag<DATAFILE_CREATE_COM_OBJ>);
+    void state_action(fsm_state_tag<DATAFILE_WRITE_FILE>);
+    void state_action(fsm_state_tag<DATAFILE_REQ_CHECKSUM>);
+    void state_action(fsm_state_tag<DATAFILE_WRITE_EXECUTE>);
+    void state_action(fsm_state_tag<BINFILE_SELECT_DATA_OBJ>);
+    void state_action(fsm_state_tag<BINFILE_CREATE_DATA_OBJ>);
+    void state_action(fsm_state_tag<BINFILE_WRITE_MTU_CHUNK>);
+    void state_action(fsm_state_tag<BINFILE_REQ_CHECKSUM>);
+    void state_action(fsm_state_tag<BINFILE_WRITE_EXECUTE>);
+    void state_action(fsm_state_tag<BINFILE_WRITE_EXECUTE_FINAL>);
+
+    /**
+     * BasicDfuServer::state_event
+     *
+     * Event handler of a state: moves to the next state according to this->received_event. States whose requests get
+     * no response move on unconditionally. Overloaded for every non-terminal state, the template does nothing.
+     *
+     */
+    template <state_t S>
+    void state_event(fsm_state_tag<S>);
+    void state_event(fsm_state_tag<DFU_IDLE>);
+    void state_event(fsm_state_tag<SET_NOTIF_VALUE>);
+    void state_event(fsm_state_tag<GET_MTU>);
+    void state_event(fsm_state_tag<DATAFILE_SELECT_COM_OBJ>);
+    void state_event(fsm_state_tag<DATAFILE_CREATE_COM_OBJ>);
+    void state_event(fsm_state_tag<DATAFILE_WRITE_FILE>);
+    void state_event(fsm_state_tag<DATAFILE_REQ_CHECKSUM>);
+    void state_event(fsm_state_tag<DATAFILE_WRITE_EXECUTE>);
+    void state_event(fsm_state_tag<BINFILE_SELECT_DATA_OBJ>);
+    void state_event(fsm_state_tag<BINFILE_CREATE_DATA_OBJ>);
+    void state_event(fsm_state_tag<BINFILE_WRITE_MTU_CHUNK>);
+    void state_event(fsm_state_tag<BINFILE_REQ_CHECKSUM>);
+    void state_event(fsm_state_tag<BINFILE_WRITE_EXECUTE>);
+    void state_event(fsm_state_tag<BINFILE_WRITE_EXECUTE_FINAL>);
+
+    /**
+     * BasicDfuServer::transition
+     *
+     * Moves the FSM from From to To. Doesn't compile unless fsm_transitions in BasicDfuServerImpl.h has the transition,
+     * or To is DFU_ERROR or DFU_ERROR_TIMEOUT.
+     *
+     */
+    template <state_t From, state_t To>
+    void transition();
+
+    /**
+     * BasicDfuServer::fsm_table_ordered
+     *
+     * Compile time check of fsm_table: every state has its entry, at its own index.
+     *
+     * @return bool: True if fsm_table is complete and ordered
+     */
+    static constexpr bool fsm_table_ordered();
+
+    /**
+     * BasicDfuServer::send_bin_object
+     *
+     * Creates the next data object of the bin file, starting at this->bin_bytes_written. When pipelining, its packets
+     * and checksum request are sent as well.
+     *
+     */
+    void send_bin_object();
+
+    /**
+     * BasicDfuServer::bin_checksum_event
+     *
+     * Handles the checksum response of a data object: moves on to execute it, resends what the device is missing or
+     * fails with DFU_ERROR_CHECKSUM. S is the state handling it: the checksum is requested on its own, or pipelined
+     * after the create or the previous execute.
+     *
+     */
+    template <state_t S>
+    void bin_checksum_event();
+
+    /**
+     * BasicDfuServer::next_response
+     *
+     * Waits for the response to the oldest request and loads it into this->response and this->received_event.
+     * received_event is ERROR_UNEXPECTED_RESP if it answers another request, NO_EVENT if no response is expected and
+     * RESPONSE_TIMEOUT if none arrived in time, in which case no response is expected anymore.
+     * Responses to internal requests, stale packet receipts and late responses to requests sent again are consumed on
+     * the way.
+     *
+     */
+    void next_response();
+
+    /**
+     * BasicDfuServer::push_response
+     *
+     * Producer side of the response ring: stores the response and wakes the FSM up if it sleeps. Never blocks, the
+     * response is dropped if the ring is full.
+     *
+     * @param queued: Parsed response
+     */
+    void push_response(const queued_response_t &queued);
+
+    /**
+     * BasicDfuServer::wait_responses
+     *
+     * Consumer side of the response ring: moves the responses received so far to this->responses, until it holds at
+     * least count of them. Checks the ring RESPONSE_SPIN_COUNT times before sleeping on cv_waiting_response.
+     *
+     * @param count: Responses needed
+     * @param timeout: Time to wait for them, none by default
+     * @return bool: False if the timeout expired first
+     */
+    bool wait_responses(size_t count, std::chrono::milliseconds timeout = std::chrono::milliseconds::max());
+
+    /**
+     * BasicDfuServer::deadline_after
+     *
+     * @param timeout: Time from now, milliseconds::max() for none
+     * @return time_point: now + timeout, saturated to time_point::max() instead of overflowing
+     */
+    static std::chrono::steady_clock::time_point deadline_after(std::chrono::milliseconds timeout);
+
+    /**
+     * BasicDfuServer::retry_request
+     *
+     * Sends the oldest request again after its response timed out, if it is safe to repeat, the only one waiting for
+     * a response and has retries left.
+     *
+     * @return bool: True if the request was sent again
+     */
+    bool retry_request();
+
+    /**
+     * BasicDfuServer::stale_response
+     *
+     * Filter shared by next_response and wait_receipt: tells whether a response is to be dropped instead of answering
+     * request. That is a receipt still in flight from before a loss, see prn_draining, or a duplicate_response.
+     *
+     * @param queued: Response taken off the ring
+     * @param request: Request it would answer, nullptr for a packet receipt
+     * @param draining: prn_draining as of the responses before this one
+     * @return bool: True if the response must be dropped
+     */
+    bool stale_response(const queued_response_t &queued, const expected_response_t *request, bool draining);
+
+    /**
+     * BasicDfuServer::last_prn_request
+     *
+     * @param index: Position of a request in expected_opcodes
+     * @return bool: True if it is the last internal PRN value set waiting for a response, which ends prn_draining
+     */
+    bool last_prn_request(size_t index);
+
+    /**
+     * BasicDfuServer::duplicate_response
+     *
+     * Tells whether a response is the late answer to a request that was sent again and answered already. Requests
+     * are answered in order, so a response with another opcode means no duplicate is coming anymore. One that could
+     * also answer a newer request or receipt with the same opcode is only taken for a duplicate until its deadline.
+     *
+     * @param queued: Response taken off the ring
+     * @param request: Oldest request waiting for a response, nullptr for a packet receipt
+     * @return bool: True if the response is a duplicate and must be dropped
+     */
+    bool duplicate_response(const queued_response_t &queued, const expected_response_t *request);
+
+    /**
+     * BasicDfuServer::discard_responses
+     *
+     * Drops the responses not used by state_event, e.g. the ones to pipelined requests sent after a failed one.
+     *
+     */
+    void discard_responses();
+
+    /**
+     * BasicDfuServer::process_response_data
+     *
+     * This function will process the data received via BLE coming from the Device and load it into
+     * control_point_response_t response. This will later be used to generate the corresponding events.
+     *
+     * @param data: Raw data received via BLE.
+     * @param response: [out] The processed response
+     * @return event_t: The event generated by the response
+     */
+    event_t process_response_data(std::string data, control_point_response_t &response);
+
+    // * Methods for checksum validation
+
+    /**
+     * BasicDfuServer::checksum_match
+     *
+     * This function will compare the stored checksum(crc32_result) with the received checksum via BLE
+     *      -uint32_t this->crc32_result: Calculated by calling BasicDfuServer::calculate_cr()
+     *      -uint32_t this->response.resp_val.checksum.crc32: Received checksum
+     *
+     * @param data: Raw data received via BLE.
+     */
+    bool checksum_match();
+
+    /**
+     * BasicDfuServer::bin_prefix_match
+     *
+     * This function will compare the received checksum with the CRC of the first offset bytes of the bin file. Used
+     * when the device reports fewer bytes than were sent, to check that what it did receive is correct and only the
+     * tail of the current object is missing.
+     *
+     * @param offset: Number of bin file bytes received by the device, as reported in the checksum response
+     * @return bool: True if offset lies in the current object and the received data matches the bin file
+     */
+    bool bin_prefix_match(uint32_t offset);
+
+    /**
+     * BasicDfuServer::object_crc
+     *
+     * Returns the CRC the device reports after receiving the first offset bytes of the data or bin file.
+     *
+     * @param object: this->datafile_data or this->binfile_data
+     * @param offset: Number of bytes received
+     * @return uint32_t: The CRC
+     */
+    uint32_t object_crc(const char *object, uint32_t offset);
+
+    /**
+     * BasicDfuServer::calculate_crc
+     *
+     * Calculates the crc of the data and saves it to this->crc32_result.
+     *
+     * @param data: Data for which the CRC will be calculated
+     * @param length: Length of the data for which the CRC will be calculated
+     */
+    void calculate_crc(const char *data, size_t length);
+
+    /**
+     * BasicDfuServer::calculate_bin_crc
+     *
+     * Calculates the crc of the first length bytes of the bin file and saves it to this->crc32_result. Uses
+     * this->bin_page_crcs when it holds the prefix, otherwise the running remainder is kept between calls, so only the
+     * bytes not checksummed yet are processed.
+     *
+     * @param length: Length of the bin file prefix for which the CRC will be calculated
+     */
+    void calculate_bin_crc(size_t length);
+
+    // * FSM states: action and event handler of each one, indexed by state_t. Defined in BasicDfuServerImpl.h
+    typedef void (BasicDfuServer::*fsm_action_t)();
+    struct fsm_state_t {
+        state_t state;
+        bool terminal;        // run_dfu returns once the FSM gets here
+        fsm_action_t action;  // fsm_action<state>
+        fsm_action_t event;   // fsm_event<state>
+    };
+    static constexpr size_t fsm_state_count = DFU_ERROR_TIMEOUT + 1;  // Last value of state_t, plus one
+    static const fsm_state_t fsm_table[fsm_state_count];
+
+    // * FSM Management Variables. Only touched by the thread running the FSM, unless noted otherwise
+    std::atomic<state_t> state;  // Read by get_state from any thread
+    control_point_response_t response;
+    event_t received_event;
+    bool pipelining;
+    uint16_t prn_window;           // Maximum packets in flight with receipt notifications, 0 if disabled
+    uint16_t prn_window_max;       // Limit of the adaptive window, 0 if prn_window is fixed
+    double pacing_window;          // Adaptive window, grows by fractions of a packet
+    uint16_t prn_device_interval;  // PRN value last sent to the device
+    uint32_t prn_packets;          // Packets sent since the device last sent a receipt or reset its count
+    bool prn_draining;  // Packets were lost, receipts still in flight are dropped until the PRN value is set again
+    bool receipts_lost;  // The last write_packets stopped early on a receipt, its loss is counted already
+    link_stats_t link_stats;  // Read by get_link_stats from any thread, guarded by mutex_link_stats
+    std::mutex mutex_link_stats;
+    std::atomic<uint16_t> packet_size;  // Payload of a DFU packet write, from the link and device MTU
+
+    // * Synchronization with BLE thread for notification variables
+    std::deque<queued_response_t> responses;  // Taken off the ring, not yet handled. FSM thread only
+    std::deque<expected_response_t> expected_opcodes;  // Requests waiting for a response, oldest first
+    std::array<queued_response_t, RESPONSE_RING_SIZE> response_ring;  // Written by the BLE thread
+    alignas(64) std::atomic<uint32_t> response_ring_head;  // Responses pushed by the BLE thread
+    alignas(64) std::atomic<uint32_t> response_ring_tail;  // Responses taken by the FSM
+    std::atomic<bool> fsm_sleeping;  // The BLE thread only takes mutex_waiting_response to wake the FSM up
+    std::atomic<bool> dfu_running;   // Notifications are ignored outside run_dfu, nothing would take them off the ring
+    std::atomic<uint32_t> responses_dropped;  // Notifications dropped with the ring full
+    std::mutex mutex_waiting_response;
+    std::condition_variable cv_waiting_response;
+
+    // * Write credits, given back by the transport thread
+    transport_capabilities_t capabilities;
+    uint32_t write_credits;  // Write commands the transport can take now
+    std::mutex mutex_write_credits;
+    std::condition_variable cv_write_credits;
+    std::chrono::milliseconds receipt_timeout;
+    connection_profile_t bulk_profile;
+    std::array<std::chrono::milliseconds, DFU_ABORT_KEY + 1> response_timeouts;  // Indexed by request opcode
+    uint8_t request_retries;
+    bool response_timed_out;  // A request went unanswered, the FSM ends in DFU_ERROR_TIMEOUT
+    // * Responses still due to requests sent again, dropped if the first request was only late. Indexed by opcode
+    std::array<uint8_t, DFU_ABORT_KEY + 1> duplicate_responses;
+    std::array<std::chrono::steady_clock::time_point, DFU_ABORT_KEY + 1> duplicate_deadlines;  // Expected until then
+
+    // * Files data in std::string format: Reference used to avoid copy constructor
+    const std::string &datafile_data;
+    const std::string &binfile_data;
+
+    // * Data file sending variables
+    uint32_t datafile_offset;  // Data file bytes already received by the device, sent from here
+    bool datafile_resumed;     // The device held this data file from an interrupted DFU
+
+    // * Bin file sending variables
+    uint32_t bin_bytes_written;    // Total bin_bytes_written
+    uint32_t bin_bytes_to_write;   // Bytes to write on mtu cycle
+    uint32_t bin_object_size;      // Maximum data object size, as reported by the device
+    uint32_t bin_object_offset;    // Offset of the current data object in the bin file
+    uint32_t bin_executed_offset;  // Bin file data executed by the device
+    uint32_t bin_object_crc;       // CRC of the bin file up to bin_executed_offset
+    uint32_t bin_execute_offset;   // End of the object being executed
+    uint32_t bin_execute_crc;      // CRC of the bin file up to bin_execute_offset
+    uint32_t object_retransmits;   // Resends of the current object
+    bool bin_execute_resumed;      // The object being executed was complete on the device from an interrupted DFU
+    bool mtu_last_chunk;
+
+    // * CRC Result is calculated and stored here before sending data
+    uint32_t crc32_result;
+
+    // * Running CRC of the bin file: remainder covering the first bin_crc_offset bytes
+    uint32_t bin_crc_remainder;
+    uint32_t bin_crc_offset;
+
+    // * Precomputed CRC of the bin file up to the end of each FLASH_PAGE_SIZE page (optional)
+    std::vector<uint32_t> bin_page_crcs;
+
+    std::vector<packet_view_t> packet_views;  // Reused by write_packets
+
+  protected:
+    // * Transport policy: This allows the DFU Server to be agnostic from the BLE implementation
+    Transport transport;
+};
+
+}  // namespace NativeDFU
+
+#include "BasicDfuServerImpl.h"
\ No newline at end of file
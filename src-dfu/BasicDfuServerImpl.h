@@ -0,0 +1,1325 @@
+#pragma once
+
+// Definitions of the BasicDfuServer templates, included by BasicDfuServer.h
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+namespace NativeDFU {
+
+template <class Transport>
+BasicDfuServer<Transport>::BasicDfuServer(Transport transport_p, const std::string &datafile_data_r,
+                                          const std::string &binfile_data_r,
+                                          const std::vector<uint32_t> &bin_page_crcs_r)
+    : state(DFU_IDLE),
+      response{},
+      received_event(NO_EVENT),
+      pipelining(false),
+      prn_window(0),
+      prn_window_max(0),
+      pacing_window(0),
+      prn_device_interval(0),
+      prn_packets(0),
+      prn_draining(false),
+      receipts_lost(false),
+      link_stats{0, 0, 0, 0},
+      packet_size(MTU_CHUNK),
+      response_ring_head(0),
+      response_ring_tail(0),
+      fsm_sleeping(false),
+      dfu_running(false),
+      responses_dropped(0),
+
+      capabilities(transport_p.capabilities()),
+      write_credits(capabilities.write_queue_depth),
+      receipt_timeout(PRN_RECEIPT_TIMEOUT_MS),
+      bulk_profile{BULK_CONNECTION_INTERVAL_US, BULK_CONNECTION_INTERVAL_US, 0, 0, true, BULK_DATA_LENGTH},
+      request_retries(MAX_REQUEST_RETRIES),
+      response_timed_out(false),
+      duplicate_responses{},
+      duplicate_deadlines{},
+
+      datafile_data(datafile_data_r),
+      binfile_data(binfile_data_r),
+
+      datafile_offset(0),
+      datafile_resumed(false),
+
+      bin_bytes_written(0),
+      bin_bytes_to_write(0),
+      bin_object_size(FLASH_PAGE_SIZE),
+      bin_object_offset(0),
+      bin_executed_offset(0),
+      bin_object_crc(0),
+      bin_execute_offset(0),
+      bin_execute_crc(0),
+      object_retransmits(0),
+      bin_execute_resumed(false),
+      mtu_last_chunk(false),
+
+      crc32_result(0),
+      bin_crc_remainder(dfu_crc_start()),
+      bin_crc_offset(0),
+      bin_page_crcs(bin_page_crcs_r),
+      transport(std::move(transport_p)) {
+    this->response_timeouts.fill(std::chrono::milliseconds(RESPONSE_TIMEOUT_MS));
+    this->response_timeouts[CREATE_KEY] = std::chrono::milliseconds(CREATE_RESPONSE_TIMEOUT_MS);
+    this->response_timeouts[EXECUTE_KEY] = std::chrono::milliseconds(EXECUTE_RESPONSE_TIMEOUT_MS);
+    std::chrono::milliseconds interval(this->capabilities.connection_interval_us / 1000);
+    this->receipt_timeout = std::max(this->receipt_timeout, PRN_RECEIPT_TIMEOUT_INTERVALS * interval);
+    if (this->capabilities.att_mtu) {
+        this->set_mtu(this->capabilities.att_mtu);
+    }
+    this->packet_views.reserve((FLASH_PAGE_SIZE + this->packet_size - 1) / this->packet_size);
+}
+
+// * Methods to send necessary data for DFU handshake
+
+// ! Generates size_str with the uint16_t num_pcks as bytes, this ASSUMES LITTLE ENDIANNESS.
+template <class Transport>
+void BasicDfuServer<Transport>::set_pck_notif_value(uint16_t num_pcks, bool internal) {
+    this->prn_device_interval = num_pcks;
+    std::string size_str(reinterpret_cast<const char *>(&num_pcks), sizeof(num_pcks));
+    this->write_procedure(std::string() + char(PACKET_RECEIPT_NOTIF_REQ_KEY) + size_str, true, internal);
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::select_object(object_type_t obj_type) {
+    this->write_procedure(std::string() + char(SELECT_OBJECT_KEY) + char(obj_type));
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::get_mtu() { this->write_procedure(std::string() + char(MTU_GET_KEY)); }
+
+// ! Generates size_str with the uint32_t size as bytes, this ASSUMES LITTLE ENDIANNESS.
+template <class Transport>
+void BasicDfuServer<Transport>::write_create_request(object_type_t obj_type, uint32_t size) {
+    std::string opcode = std::string() + char(CREATE_KEY);
+    switch (obj_type) {
+        case COMMAND:
+            opcode.append(std::string() + char(COMMAND));
+            break;
+
+        case DATA:
+            opcode.append(std::string() + char(DATA));
+            break;
+
+        default:
+            // std::cout << "I'm a donkey and wrongly called write_create_request. I should read DFU documentation" <<
+            // std::endl;
+            break;
+    }
+    std::string size_str(reinterpret_cast<const char *>(&size), sizeof(size));
+    this->write_procedure(opcode + size_str);
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::write_packet(const char *data, size_t length) {
+    this->transport.write_command(DFU_PACKET, reinterpret_cast<const uint8_t *>(data), length);
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::write_packets(const char *data, size_t length, uint32_t offset) {
+    // Receipts are requested every half window, so one is always on its way while the other half is sent
+    if (this->prn_window && this->prn_interval() != this->prn_device_interval) {
+        this->set_pck_notif_value(this->prn_interval(), true);  // Adaptive window changed since the last object
+    }
+    uint32_t interval = this->prn_device_interval;
+    this->receipts_lost = false;
+    std::deque<packet_receipt_t> receipts;
+    size_t packet_size = this->packet_size;
+    size_t sent = 0;
+    auto start = std::chrono::steady_clock::now();
+    uint32_t confirmed = offset;
+    // CRC of the object up to the last receipt, extended by the packets sent since for the next one
+    uint32_t receipt_crc = this->prn_window ? this->object_crc(data - offset, offset) : 0;
+    size_t receipt_sent = 0;
+
+    while (sent < length) {
+        size_t packets = (length - sent + packet_size - 1) / packet_size;
+        if (this->prn_window) {
+            // An adaptive window can grow past the interval, but not shrink below it until the interval is set again
+            uint32_t window = std::max<uint32_t>(this->prn_window, interval);
+            uint32_t in_flight = receipts.size() * interval + this->prn_packets;
+            if (in_flight >= window) {
+                if (!this->wait_receipt(receipts.front())) {
+                    this->resync_receipts();
+                    return;
+                }
+                this->receipt_received();
+                confirmed = receipts.front().offset;
+                receipts.pop_front();
+                continue;
+            }
+            packets = std::min<size_t>({packets, interval - this->prn_packets, window - in_flight});
+        }
+        packets = this->take_write_credits(packets);
+        if (!packets) {
+            // Transport stuck: the checksum request that follows tells what is missing
+            if (this->prn_window) {
+                this->resync_receipts();
+            }
+            return;
+        }
+
+        size_t burst = std::min(length - sent, packets * packet_size);
+        if (this->transport.batches_writes()) {
+            this->packet_views.clear();
+            for (size_t chunk = sent; chunk < sent + burst; chunk += packet_size) {
+                this->packet_views.push_back({reinterpret_cast<const uint8_t *>(&data[chunk]),
+                                              std::min(packet_size, sent + burst - chunk)});
+            }
+            this->transport.write_command_batch(DFU_PACKET, this->packet_views.data(), this->packet_views.size());
+        } else {
+            for (size_t chunk = sent; chunk < sent + burst; chunk += packet_size) {
+                this->write_packet(&data[chunk], std::min(packet_size, sent + burst - chunk));
+            }
+        }
+        sent += burst;
+
+        if (this->prn_window) {
+            this->prn_packets += packets;
+            if (this->prn_packets == interval) {
+                this->prn_packets = 0;
+                uint32_t receipt_offset = offset + sent;
+                size_t unhashed = sent - receipt_sent;
+                receipt_crc = dfu_crc_combine(receipt_crc, dfu_crc(&data[receipt_sent], unhashed), unhashed);
+                receipt_sent = sent;
+                receipts.push_back({receipt_offset, receipt_crc});
+            }
+        }
+    }
+
+    // No receipt is left behind to be mistaken for the checksum response
+    for (const packet_receipt_t &receipt : receipts) {
+        if (!this->wait_receipt(receipt)) {
+            this->resync_receipts();
+            return;
+        }
+        this->receipt_received();
+        confirmed = receipt.offset;
+    }
+    if (confirmed > offset) {
+        this->measure_throughput(confirmed - offset, std::chrono::steady_clock::now() - start);
+    }
+}
+
+template <class Transport>
+bool BasicDfuServer<Transport>::wait_receipt(const packet_receipt_t &expected) {
+    // Everything requested before these packets is answered first, the receipt comes right after. Those responses are
+    // left for next_response, what it would drop on the way is dropped here already.
+    auto deadline = deadline_after(this->receipt_timeout);
+    bool draining = this->prn_draining;
+    size_t answered = 0;  // Requests answered by this->responses[0, index)
+    size_t index = 0;
+    while (true) {
+        if (index == this->responses.size()) {
+            auto left = deadline - std::chrono::steady_clock::now();
+            auto left_ms = std::chrono::duration_cast<std::chrono::milliseconds>(left);
+            if (left_ms.count() <= 0 || !this->wait_responses(index + 1, left_ms)) {
+                return false;
+            }
+        }
+        const expected_response_t *request =
+            (answered < this->expected_opcodes.size()) ? &this->expected_opcodes[answered] : nullptr;
+        if (this->stale_response(this->responses[index], request, draining)) {
+            this->responses.erase(this->responses.begin() + index);
+            continue;
+        }
+        if (request) {
+            if (this->last_prn_request(answered)) {
+                draining = false;
+            }
+            answered++;
+            index++;
+            continue;
+        }
+
+        queued_response_t receipt = this->responses[index];
+        this->responses.erase(this->responses.begin() + index);
+        // A lost packet shows as a short offset, or as a wrong CRC when the next packet made up the count
+        return receipt.event == CHECKSUM_RECEIVED && receipt.response.request_opcode == CALCULATE_CHECKSUM_KEY &&
+               receipt.response.resp_val.checksum.offset == expected.offset &&
+               receipt.response.resp_val.checksum.crc32 == expected.crc32;
+    }
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::resync_receipts() {
+    // Packets lost: the rest of the object is not sent, the checksum request that follows tells what is missing.
+    // Receipts still in flight are dropped until the device restarts counting on a new PRN value.
+    this->packets_lost();
+    this->receipts_lost = true;
+    this->prn_draining = true;
+    this->set_pck_notif_value(this->prn_interval(), true);
+}
+
+template <class Transport>
+uint32_t BasicDfuServer<Transport>::prn_interval() { return std::max(1, this->prn_window / 2); }
+
+template <class Transport>
+uint32_t BasicDfuServer<Transport>::take_write_credits(uint32_t packets) {
+    if (!this->capabilities.write_queue_depth) {
+        return packets;
+    }
+    std::unique_lock<std::mutex> lock(mutex_write_credits);
+    if (!cv_write_credits.wait_for(lock, std::chrono::milliseconds(WRITE_CREDIT_TIMEOUT_MS),
+                                   [&] { return this->write_credits > 0; })) {
+        return 0;
+    }
+    uint32_t taken = std::min(packets, this->write_credits);
+    this->write_credits -= taken;
+    return taken;
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::measure_throughput(uint32_t bytes, std::chrono::steady_clock::duration elapsed) {
+    double seconds = std::chrono::duration<double>(elapsed).count();
+    if (seconds > 0) {
+        // Smoothed like a TCP round trip time, a slow object once in a while doesn't swing the estimate
+        double sample = bytes / seconds;
+        std::lock_guard<std::mutex> guard(mutex_link_stats);
+        double previous = this->link_stats.throughput;
+        this->link_stats.throughput = previous ? (7 * previous + sample) / 8 : sample;
+    }
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::receipt_received() {
+    if (this->prn_window_max && !this->object_retransmits) {
+        // Not while resending: a loss costs the whole object, the window only shrinks until it gets through
+        // Additive increase: one packet per window of confirmed packets
+        this->pacing_window += this->prn_device_interval / this->pacing_window;
+        this->pacing_window = std::min<double>(this->pacing_window, this->prn_window_max);
+        this->prn_window = static_cast<uint16_t>(this->pacing_window);
+    }
+    std::lock_guard<std::mutex> guard(mutex_link_stats);
+    this->link_stats.window = this->prn_window;
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::packets_lost() {
+    if (this->prn_window_max) {
+        // Multiplicative decrease: the controller queue overflowed, back off by half
+        double min_window = std::min<uint16_t>(PACING_MIN_WINDOW, this->prn_window_max);
+        this->pacing_window = std::max(min_window, this->pacing_window / 2);
+        this->prn_window = static_cast<uint16_t>(this->pacing_window);
+    }
+    std::lock_guard<std::mutex> guard(mutex_link_stats);
+    this->link_stats.losses++;
+    this->link_stats.window = this->prn_window;
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::request_checksum() {
+    this->write_procedure(std::string() + char(CALCULATE_CHECKSUM_KEY));
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::write_execute() { this->write_procedure(std::string() + char(EXECUTE_KEY)); }
+
+template <class Transport>
+void BasicDfuServer<Transport>::write_procedure(const std::string &opcode_parameters, bool response, bool internal) {
+    // std::cout << "[WRITE_OPCODE] char-write-req: 0x000f  " << ToHex(opcode, true) << std::endl;
+    if (response) {
+        this->expected_opcodes.push_back({static_cast<uint8_t>(opcode_parameters[0]), internal, opcode_parameters, 0});
+    }
+    if (opcode_parameters[0] == CREATE_KEY || opcode_parameters[0] == PACKET_RECEIPT_NOTIF_REQ_KEY) {
+        this->prn_packets = 0;  // The device restarts counting packets
+    }
+    this->transport.write_request(DFU_CONTROL_POINT, reinterpret_cast<const uint8_t *>(opcode_parameters.data()),
+                                  opcode_parameters.length());
+}
+
+// * High level Public Methods to Handle FSM
+
+template <class Transport>
+void BasicDfuServer<Transport>::run_dfu() {
+    // Power saving parameters the device connected with would dominate the transfer time
+    connection_profile_t previous_profile = {};
+    bool bulk_profile_set = this->transport.set_connection_profile(this->bulk_profile, &previous_profile);
+
+    this->dfu_running.store(true, std::memory_order_release);
+    while (!fsm_table[this->state].terminal) {
+        this->run();
+    }
+    this->dfu_running.store(false, std::memory_order_release);
+
+    if (bulk_profile_set) {
+        this->transport.set_connection_profile(previous_profile, nullptr);
+    }
+}
+
+// ! Will be called on a BLE reception via a thread, be careful with raceconditions and synchronization
+template <class Transport>
+void BasicDfuServer<Transport>::notify(std::string service, std::string characteristic, std::string data) {
+    this->notify(resolve_characteristic(service, characteristic), reinterpret_cast<const uint8_t *>(data.data()),
+                 data.length());
+}
+
+// ! Will be called on a BLE reception via a thread, be careful with raceconditions and synchronization
+template <class Transport>
+void BasicDfuServer<Transport>::notify(dfu_characteristic_t characteristic, const uint8_t *data, size_t length) {
+    if (!this->dfu_running.load(std::memory_order_acquire)) {
+        // Stray or late response: no FSM to take it off the ring
+    } else if (characteristic == DFU_CONTROL_POINT) {
+        if (length && data[0] == RESPONSE_CODE_KEY) {
+            queued_response_t queued;
+            queued.event = process_response_data(std::string(reinterpret_cast<const char *>(data), length),
+                                                 queued.response);
+            // std::cout << "Event Received  " << queued.event << std::endl;
+            this->push_response(queued);
+            // std::cout << "Notified" << std::endl;
+        } else {
+            // ERROR_NO_RESP_KEY: ignored, the FSM keeps waiting for a response
+            // std::cout << "Received Data not starting with response key" << std::endl;
+        }
+    } else {
+        // ERROR_NOT_SUP_SERV_CHAR: ignored, the FSM keeps waiting for a response
+        // std::cout << "Not Supported service or characteristic for notify " << std::endl;
+    }
+}
+
+template <class Transport>
+dfu_characteristic_t BasicDfuServer<Transport>::resolve_characteristic(const std::string &service,
+                                                                       const std::string &characteristic) {
+    if (service != service_uuid()) {
+        return DFU_UNKNOWN_CHAR;
+    } else if (characteristic == characteristic_uuid(DFU_CONTROL_POINT)) {
+        return DFU_CONTROL_POINT;
+    } else if (characteristic == characteristic_uuid(DFU_PACKET)) {
+        return DFU_PACKET;
+    }
+    return DFU_UNKNOWN_CHAR;
+}
+
+// UUIDs are built once, for the string based interfaces only
+template <class Transport>
+const std::string &BasicDfuServer<Transport>::characteristic_uuid(dfu_characteristic_t characteristic) {
+    static const std::string dfu_control_point_char(NORDIC_DFU_CONTROL_POINT_CHAR);
+    static const std::string dfu_packet_char(NORDIC_DFU_PACKET_CHAR);
+    static const std::string unknown_char;
+    switch (characteristic) {
+        case DFU_CONTROL_POINT:
+            return dfu_control_point_char;
+
+        case DFU_PACKET:
+            return dfu_packet_char;
+
+        default:
+            return unknown_char;
+    }
+}
+
+template <class Transport>
+const std::string &BasicDfuServer<Transport>::service_uuid() {
+    static const std::string dfu_service(NORDIC_SECURE_DFU_SERVICE);
+    return dfu_service;
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::set_pipelining(bool enable) { this->pipelining = enable; }
+
+template <class Transport>
+void BasicDfuServer<Transport>::set_prn_window(uint16_t packets) {
+    this->prn_window = packets;
+    this->prn_window_max = 0;
+    std::lock_guard<std::mutex> guard(mutex_link_stats);
+    this->link_stats.window = packets;
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::set_adaptive_window(uint16_t max_packets) {
+    // Start with the pipe the transport reports, if any
+    uint16_t initial = this->capabilities.write_queue_depth;
+    this->prn_window_max = max_packets;
+    this->pacing_window = std::min<uint16_t>(initial ? initial : PACING_INITIAL_WINDOW, max_packets);
+    this->prn_window = static_cast<uint16_t>(this->pacing_window);
+    std::lock_guard<std::mutex> guard(mutex_link_stats);
+    this->link_stats.window = this->prn_window;
+}
+
+template <class Transport>
+link_stats_t BasicDfuServer<Transport>::get_link_stats() {
+    std::lock_guard<std::mutex> guard(mutex_link_stats);
+    link_stats_t stats = this->link_stats;
+    stats.responses_dropped = this->responses_dropped.load(std::memory_order_relaxed);
+    return stats;
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::set_response_timeout(op_code_t opcode, std::chrono::milliseconds timeout) {
+    if (opcode < this->response_timeouts.size()) {
+        this->response_timeouts[opcode] = timeout;
+    }
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::set_request_retries(uint8_t retries) { this->request_retries = retries; }
+
+template <class Transport>
+void BasicDfuServer<Transport>::set_bulk_profile(const connection_profile_t &profile) { this->bulk_profile = profile; }
+
+// ! Will be called by the transport via a thread, be careful with raceconditions and synchronization
+template <class Transport>
+void BasicDfuServer<Transport>::add_write_credits(uint16_t packets) {
+    std::lock_guard<std::mutex> guard(mutex_write_credits);
+    // Never more than the queue holds, whatever the transport reports
+    this->write_credits = std::min<uint32_t>(this->write_credits + packets, this->capabilities.write_queue_depth);
+    this->cv_write_credits.notify_all();
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::set_mtu(uint16_t att_mtu) {
+    this->packet_size = std::max<uint16_t>(att_mtu, ATT_MTU_MIN) - ATT_HEADER_LEN;
+    this->packet_views.reserve((FLASH_PAGE_SIZE + this->packet_size - 1) / this->packet_size);
+}
+
+template <class Transport>
+uint16_t BasicDfuServer<Transport>::get_packet_size() { return this->packet_size; }
+
+template <class Transport>
+state_t BasicDfuServer<Transport>::get_state() { return this->state; }
+
+// * Methods to Handle FSM
+
+// Transitions state_event may take, checked at compile time by BasicDfuServer::transition. Any state can also fail with
+// DFU_ERROR, or DFU_ERROR_TIMEOUT when the device stops answering.
+struct fsm_transition_t {
+    state_t from;
+    state_t to;
+};
+
+inline constexpr fsm_transition_t fsm_transitions[] = {
+    {DFU_IDLE, SET_NOTIF_VALUE},
+    {SET_NOTIF_VALUE, GET_MTU},
+    {GET_MTU, DATAFILE_SELECT_COM_OBJ},
+    {DATAFILE_SELECT_COM_OBJ, DATAFILE_CREATE_COM_OBJ},
+    {DATAFILE_SELECT_COM_OBJ, DATAFILE_WRITE_FILE},  // Resumed, part of the data file received
+    {DATAFILE_SELECT_COM_OBJ, DATAFILE_WRITE_EXECUTE},  // Resumed, whole data file received
+    {DATAFILE_CREATE_COM_OBJ, DATAFILE_WRITE_FILE},
+    {DATAFILE_WRITE_FILE, DATAFILE_REQ_CHECKSUM},
+    {DATAFILE_REQ_CHECKSUM, DATAFILE_WRITE_EXECUTE},
+    {DATAFILE_REQ_CHECKSUM, DATAFILE_CREATE_COM_OBJ},  // Data file lost on the way, sent again
+    {DATAFILE_REQ_CHECKSUM, DFU_ERROR_CHECKSUM},
+    {DATAFILE_WRITE_EXECUTE, BINFILE_SELECT_DATA_OBJ},
+    {BINFILE_SELECT_DATA_OBJ, BINFILE_CREATE_DATA_OBJ},
+    {BINFILE_SELECT_DATA_OBJ, BINFILE_WRITE_MTU_CHUNK},  // Resumed inside an object
+    {BINFILE_SELECT_DATA_OBJ, BINFILE_WRITE_EXECUTE},    // Resumed at the end of an object
+    {BINFILE_CREATE_DATA_OBJ, BINFILE_WRITE_MTU_CHUNK},
+    {BINFILE_WRITE_MTU_CHUNK, BINFILE_REQ_CHECKSUM},
+    {BINFILE_WRITE_EXECUTE, BINFILE_WRITE_EXECUTE_FINAL},
+    {BINFILE_WRITE_EXECUTE, BINFILE_CREATE_DATA_OBJ},
+    {BINFILE_WRITE_EXECUTE_FINAL, DFU_FINISHED},
+    // Checksum of a data object, requested on its own or pipelined after the create or the previous execute
+    {BINFILE_REQ_CHECKSUM, BINFILE_WRITE_EXECUTE},
+    {BINFILE_REQ_CHECKSUM, BINFILE_WRITE_MTU_CHUNK},
+    {BINFILE_REQ_CHECKSUM, BINFILE_CREATE_DATA_OBJ},
+    {BINFILE_REQ_CHECKSUM, DFU_ERROR_CHECKSUM},
+    {BINFILE_CREATE_DATA_OBJ, BINFILE_WRITE_EXECUTE},
+    {BINFILE_CREATE_DATA_OBJ, BINFILE_CREATE_DATA_OBJ},
+    {BINFILE_CREATE_DATA_OBJ, DFU_ERROR_CHECKSUM},
+    {BINFILE_WRITE_EXECUTE, BINFILE_WRITE_EXECUTE},
+    {BINFILE_WRITE_EXECUTE, BINFILE_WRITE_MTU_CHUNK},
+    {BINFILE_WRITE_EXECUTE, DFU_ERROR_CHECKSUM},
+};
+
+constexpr bool fsm_terminal(state_t state) {
+    return state == DFU_ERROR_CHECKSUM || state == DFU_ERROR || state == DFU_ERROR_TIMEOUT || state == DFU_FINISHED;
+}
+
+constexpr bool fsm_allows(state_t from, state_t to) {
+    if (fsm_terminal(from)) {
+        return false;
+    } else if (to == DFU_ERROR || to == DFU_ERROR_TIMEOUT) {
+        return true;
+    }
+    for (const fsm_transition_t &transition : fsm_transitions) {
+        if (transition.from == from && transition.to == to) {
+            return true;
+        }
+    }
+    return false;
+}
+
+template <class Transport>
+template <state_t From, state_t To>
+void BasicDfuServer<Transport>::transition() {
+    static_assert(fsm_allows(From, To), "Transition missing from fsm_transitions");
+    this->state = To;
+}
+
+template <class Transport>
+template <state_t S>
+void BasicDfuServer<Transport>::fsm_action() {
+    this->state_action(fsm_state_tag<S>());
+}
+
+template <class Transport>
+template <state_t S>
+void BasicDfuServer<Transport>::fsm_event() {
+    this->state_event(fsm_state_tag<S>());
+}
+
+// Nothing to send on entering DFU_IDLE and the terminal states, and nothing to wait for in the terminal states
+template <class Transport>
+template <state_t S>
+void BasicDfuServer<Transport>::state_action(fsm_state_tag<S>) {}
+
+template <class Transport>
+template <state_t S>
+void BasicDfuServer<Transport>::state_event(fsm_state_tag<S>) {}
+
+// * Actions: requests sent on entering each state
+
+template <class Transport>
+void BasicDfuServer<Transport>::state_action(fsm_state_tag<SET_NOTIF_VALUE>) {
+    this->set_pck_notif_value(this->prn_window ? this->prn_interval() : 0);
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::state_action(fsm_state_tag<GET_MTU>) {
+    if (this->capabilities.att_mtu) {
+        return;  // The transport negotiated the MTU, nothing to ask the device
+    }
+    this->get_mtu();
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::state_action(fsm_state_tag<DATAFILE_SELECT_COM_OBJ>) {
+    this->select_object(NativeDFU::COMMAND);
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::state_action(fsm_state_tag<DATAFILE_CREATE_COM_OBJ>) {
+    // A new command object: the data file is sent from the start and was never executed
+    this->datafile_offset = 0;
+    this->datafile_resumed = false;
+    this->write_create_request(NativeDFU::COMMAND, this->datafile_data.length());
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::state_action(fsm_state_tag<DATAFILE_WRITE_FILE>) {
+    // Device does not respond until checksum request
+    this->calculate_crc(this->datafile_data.c_str(), this->datafile_data.length());
+    this->write_packets(&this->datafile_data.data()[this->datafile_offset],
+                        this->datafile_data.length() - this->datafile_offset, this->datafile_offset);
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::state_action(fsm_state_tag<DATAFILE_REQ_CHECKSUM>) {
+    this->request_checksum();
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::state_action(fsm_state_tag<DATAFILE_WRITE_EXECUTE>) {
+    this->write_execute();
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::state_action(fsm_state_tag<BINFILE_SELECT_DATA_OBJ>) {
+    this->select_object(NativeDFU::DATA);
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::state_action(fsm_state_tag<BINFILE_CREATE_DATA_OBJ>) {
+    this->send_bin_object();
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::state_action(fsm_state_tag<BINFILE_WRITE_MTU_CHUNK>) {
+    if (this->prn_window && this->bin_bytes_written != this->bin_object_offset) {
+        // Resending a tail: packets were lost, so the device's count is off. Reset it
+        this->set_pck_notif_value(this->prn_interval(), true);
+    }
+    this->write_packets(&this->binfile_data.c_str()[this->bin_bytes_written], this->bin_bytes_to_write,
+                        this->bin_bytes_written);
+    this->bin_bytes_written += this->bin_bytes_to_write;
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::state_action(fsm_state_tag<BINFILE_REQ_CHECKSUM>) {
+    this->request_checksum();
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::state_action(fsm_state_tag<BINFILE_WRITE_EXECUTE>) {
+    this->bin_execute_offset = this->bin_bytes_written;
+    this->bin_execute_crc = this->crc32_result;
+    this->write_execute();
+    if (this->pipelining && !this->mtu_last_chunk) {
+        // Checksum already verified: the next object follows without waiting for the execute response
+        this->send_bin_object();
+    }
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::state_action(fsm_state_tag<BINFILE_WRITE_EXECUTE_FINAL>) {
+    this->write_procedure(std::string() + char(EXECUTE_KEY), false);  // * Final Execute does not respond!
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::send_bin_object() {
+    this->bin_bytes_to_write = this->bin_object_size;
+    this->mtu_last_chunk = false;
+
+    if ((this->binfile_data.length() - this->bin_bytes_written) <= this->bin_object_size) {
+        this->bin_bytes_to_write = (this->binfile_data.length() - this->bin_bytes_written);
+        this->mtu_last_chunk = true;
+        // std::cout << " Last mtu chunk " << std::endl;
+    }
+
+    if (this->bin_bytes_to_write) {
+        this->bin_object_offset = this->bin_bytes_written;
+        // CRC is for all the data written, not just the last flash page!
+        this->calculate_bin_crc(this->bin_bytes_written + this->bin_bytes_to_write);
+        this->write_create_request(NativeDFU::DATA, this->bin_bytes_to_write);
+
+        if (this->pipelining) {
+            // The bootloader handles requests in order: packets and checksum don't wait for the create response
+            this->write_packets(&this->binfile_data.c_str()[this->bin_bytes_written], this->bin_bytes_to_write,
+                                this->bin_bytes_written);
+            this->bin_bytes_written += this->bin_bytes_to_write;
+            this->request_checksum();
+        }
+    }
+}
+
+// * Events: next state from the responses to the requests sent by the state's action
+
+template <class Transport>
+void BasicDfuServer<Transport>::state_event(fsm_state_tag<DFU_IDLE>) {
+    this->transition<DFU_IDLE, SET_NOTIF_VALUE>();
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::state_event(fsm_state_tag<SET_NOTIF_VALUE>) {
+    if (this->received_event == PACKET_RECEIPT_NOTIF_REQ_SUC) {
+        this->transition<SET_NOTIF_VALUE, GET_MTU>();
+    } else {
+        this->transition<SET_NOTIF_VALUE, DFU_ERROR>();
+        // std::cout << "Unknow event for the current state" << std::endl;
+    }
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::state_event(fsm_state_tag<GET_MTU>) {
+    if (this->received_event == MTU_RECEIVED && this->response.resp_val.mtu.size >= ATT_MTU_MIN) {
+        uint16_t device_packet_size = this->response.resp_val.mtu.size - ATT_HEADER_LEN;
+        this->packet_size = std::min<uint16_t>(this->packet_size, device_packet_size);
+    }
+    // Skipped, reported as 0 or answered with OPCODE_NOT_SUP_RESP: the packet size of the link is kept
+    this->transition<GET_MTU, DATAFILE_SELECT_COM_OBJ>();
+}
+
+// If the device already holds the start of this data file, only the rest is sent and the bin file progress on the
+// device is kept. Otherwise the command object is created.
+template <class Transport>
+void BasicDfuServer<Transport>::state_event(fsm_state_tag<DATAFILE_SELECT_COM_OBJ>) {
+    if (this->received_event != SELECT_OBJ_RECEIVED) {
+        this->transition<DATAFILE_SELECT_COM_OBJ, DFU_ERROR>();
+        // std::cout << "Unknow event for the current state" << std::endl;
+        return;
+    }
+
+    uint32_t offset = this->response.resp_val.select.offset;
+    if (offset == 0 || offset > this->datafile_data.length() ||
+        dfu_crc(this->datafile_data.c_str(), offset) != this->response.resp_val.select.crc32) {
+        // Nothing received yet, or another data file: creating the command object starts the DFU over
+        this->transition<DATAFILE_SELECT_COM_OBJ, DATAFILE_CREATE_COM_OBJ>();
+        return;
+    }
+
+    // Same data file as the interrupted DFU, executing it again keeps the bin file received so far
+    this->datafile_resumed = true;
+    this->datafile_offset = offset;
+    if (offset < this->datafile_data.length()) {
+        this->transition<DATAFILE_SELECT_COM_OBJ, DATAFILE_WRITE_FILE>();
+    } else {
+        this->transition<DATAFILE_SELECT_COM_OBJ, DATAFILE_WRITE_EXECUTE>();
+    }
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::state_event(fsm_state_tag<DATAFILE_CREATE_COM_OBJ>) {
+    if (this->received_event == CREATE_SUC) {
+        this->transition<DATAFILE_CREATE_COM_OBJ, DATAFILE_WRITE_FILE>();
+    } else {
+        this->transition<DATAFILE_CREATE_COM_OBJ, DFU_ERROR>();
+        // std::cout << "Unknow event for the current state" << std::endl;
+    }
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::state_event(fsm_state_tag<DATAFILE_WRITE_FILE>) {
+    this->transition<DATAFILE_WRITE_FILE, DATAFILE_REQ_CHECKSUM>();
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::state_event(fsm_state_tag<DATAFILE_REQ_CHECKSUM>) {
+    if (this->received_event == CHECKSUM_RECEIVED) {
+        if (this->checksum_match()) {
+            this->transition<DATAFILE_REQ_CHECKSUM, DATAFILE_WRITE_EXECUTE>();
+        } else if (this->response.resp_val.checksum.offset < this->datafile_data.length() &&
+                   this->object_retransmits < MAX_OBJECT_RETRANSMITS) {
+            // Data file lost on the way: create the command object again and resend it
+            this->object_retransmits++;
+            this->transition<DATAFILE_REQ_CHECKSUM, DATAFILE_CREATE_COM_OBJ>();
+        } else {
+            this->transition<DATAFILE_REQ_CHECKSUM, DFU_ERROR_CHECKSUM>();
+            // std::cout << "Invalid Checksum" << std::endl;
+        }
+    } else {
+        this->transition<DATAFILE_REQ_CHECKSUM, DFU_ERROR>();
+        // std::cout << "Unknow event for the current state" << std::endl;
+    }
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::state_event(fsm_state_tag<DATAFILE_WRITE_EXECUTE>) {
+    // A data file executed before the DFU was interrupted may be refused a second time, any other error is a failure
+    bool refused = this->received_event == ERROR_RECEIVED && this->response.result_code == OP_NOT_PERM_RESP;
+    if (this->received_event == EXECUTE_SUC || (this->datafile_resumed && refused)) {
+        this->object_retransmits = 0;
+        this->transition<DATAFILE_WRITE_EXECUTE, BINFILE_SELECT_DATA_OBJ>();
+    } else {
+        this->transition<DATAFILE_WRITE_EXECUTE, DFU_ERROR>();
+        // std::cout << "Unknow event for the current state" << std::endl;
+    }
+}
+
+// Data objects are sized by the reported maximum. When the device holds part of the bin file from an interrupted DFU,
+// the DFU continues from the last byte matching the local image: a complete object is executed, a partial one
+// completed, and one with a mismatching CRC created again.
+template <class Transport>
+void BasicDfuServer<Transport>::state_event(fsm_state_tag<BINFILE_SELECT_DATA_OBJ>) {
+    if (this->received_event != SELECT_OBJ_RECEIVED) {
+        this->transition<BINFILE_SELECT_DATA_OBJ, DFU_ERROR>();
+        // std::cout << "Unknow event for the current state" << std::endl;
+        return;
+    }
+    if (this->response.resp_val.select.maximum_size) {
+        // Larger objects mean fewer create, checksum and execute round trips per image
+        this->bin_object_size = this->response.resp_val.select.maximum_size;
+    }
+
+    uint32_t offset = this->response.resp_val.select.offset;
+    if (offset == 0) {
+        this->transition<BINFILE_SELECT_DATA_OBJ, BINFILE_CREATE_DATA_OBJ>();
+        return;
+    } else if (offset > this->binfile_data.length()) {
+        // Progress of a bigger image, the data file should have prevented this
+        this->transition<BINFILE_SELECT_DATA_OBJ, DFU_ERROR>();
+        return;
+    }
+
+    // Same split in objects as nrfutil: the device holds whole objects, plus part of the last one if remainder != 0
+    uint32_t remainder = offset % this->bin_object_size;
+    uint32_t object_offset = offset - (remainder ? remainder : this->bin_object_size);
+    this->calculate_bin_crc(object_offset);
+    this->bin_executed_offset = this->bin_execute_offset = this->bin_object_offset = object_offset;
+    this->bin_object_crc = this->bin_execute_crc = this->crc32_result;
+
+    this->calculate_bin_crc(offset);
+    if (this->crc32_result != this->response.resp_val.select.crc32) {
+        // Drop the last object, which holds the corrupted data, and send it again
+        this->bin_bytes_written = object_offset;
+        this->transition<BINFILE_SELECT_DATA_OBJ, BINFILE_CREATE_DATA_OBJ>();
+        return;
+    }
+
+    this->bin_bytes_written = offset;
+    size_t object_length = std::min<size_t>(this->bin_object_size, this->binfile_data.length() - object_offset);
+    uint32_t object_end = object_offset + object_length;
+    this->mtu_last_chunk = (object_end == this->binfile_data.length());
+    this->calculate_bin_crc(object_end);
+    if (offset == object_end) {
+        // Complete, maybe executed already, in which case the device refuses to execute it again
+        this->bin_execute_resumed = true;
+        this->transition<BINFILE_SELECT_DATA_OBJ, BINFILE_WRITE_EXECUTE>();
+    } else {
+        // Send the rest of the object, then checksum and execute it
+        this->bin_bytes_to_write = object_end - offset;
+        this->transition<BINFILE_SELECT_DATA_OBJ, BINFILE_WRITE_MTU_CHUNK>();
+    }
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::state_event(fsm_state_tag<BINFILE_CREATE_DATA_OBJ>) {
+    if (this->received_event == CREATE_SUC) {
+        if (this->pipelining) {
+            this->next_response();  // Checksum requested right after the packets
+            this->bin_checksum_event<BINFILE_CREATE_DATA_OBJ>();
+        } else {
+            this->transition<BINFILE_CREATE_DATA_OBJ, BINFILE_WRITE_MTU_CHUNK>();
+        }
+    } else {
+        this->transition<BINFILE_CREATE_DATA_OBJ, DFU_ERROR>();
+        // std::cout << "Unknow event for the current state" << std::endl;
+    }
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::state_event(fsm_state_tag<BINFILE_WRITE_MTU_CHUNK>) {
+    this->transition<BINFILE_WRITE_MTU_CHUNK, BINFILE_REQ_CHECKSUM>();
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::state_event(fsm_state_tag<BINFILE_REQ_CHECKSUM>) {
+    this->bin_checksum_event<BINFILE_REQ_CHECKSUM>();
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::state_event(fsm_state_tag<BINFILE_WRITE_EXECUTE>) {
+    // An object executed before the DFU was interrupted is refused a second time, the device moved past it already.
+    // Any other error is a failure to validate or write it.
+    bool refused = this->received_event == ERROR_RECEIVED && this->response.result_code == OP_NOT_PERM_RESP;
+    bool executed = this->received_event == EXECUTE_SUC || (this->bin_execute_resumed && refused);
+    this->bin_execute_resumed = false;
+    if (executed) {
+        this->bin_executed_offset = this->bin_execute_offset;
+        this->bin_object_crc = this->bin_execute_crc;
+        this->object_retransmits = 0;
+        if (this->bin_executed_offset == this->binfile_data.length()) {
+            this->transition<BINFILE_WRITE_EXECUTE, BINFILE_WRITE_EXECUTE_FINAL>();
+        } else if (this->pipelining) {
+            // Responses to the next object, sent along with the execute
+            this->next_response();
+            if (this->received_event == CREATE_SUC) {
+                this->next_response();
+                this->bin_checksum_event<BINFILE_WRITE_EXECUTE>();
+            } else if (this->object_retransmits < MAX_OBJECT_RETRANSMITS) {
+                // The next object was not created, so its packets were dropped: its checksum response is drained and
+                // the object is created and sent again from the executed offset
+                this->object_retransmits++;
+                this->bin_bytes_written = this->bin_executed_offset;
+                this->transition<BINFILE_WRITE_EXECUTE, BINFILE_CREATE_DATA_OBJ>();
+            } else {
+                this->transition<BINFILE_WRITE_EXECUTE, DFU_ERROR>();
+            }
+        } else {
+            this->transition<BINFILE_WRITE_EXECUTE, BINFILE_CREATE_DATA_OBJ>();
+        }
+    } else if (this->pipelining && this->object_retransmits < MAX_OBJECT_RETRANSMITS) {
+        // Roll back: the next object was created after the failed execute, which discards the unexecuted data on the
+        // device. Its responses are dropped and the object is sent again.
+        this->object_retransmits++;
+        this->bin_bytes_written = this->bin_executed_offset;
+        this->transition<BINFILE_WRITE_EXECUTE, BINFILE_CREATE_DATA_OBJ>();
+    } else {
+        this->transition<BINFILE_WRITE_EXECUTE, DFU_ERROR>();
+        // std::cout << "Unknow event for the current state" << std::endl;
+    }
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::state_event(fsm_state_tag<BINFILE_WRITE_EXECUTE_FINAL>) {
+    if (this->received_event == EXECUTE_SUC) {
+        this->transition<BINFILE_WRITE_EXECUTE_FINAL, DFU_FINISHED>();
+    } else {
+        this->transition<BINFILE_WRITE_EXECUTE_FINAL, DFU_ERROR>();
+        // std::cout << "Unknow event for the current state" << std::endl;
+    }
+}
+
+template <class Transport>
+template <state_t S>
+void BasicDfuServer<Transport>::bin_checksum_event() {
+    if (this->received_event == CHECKSUM_RECEIVED) {
+        if (this->checksum_match() && this->response.resp_val.checksum.offset == this->bin_bytes_written) {
+            this->transition<S, BINFILE_WRITE_EXECUTE>();
+            // std::cout << "Received checksum: 0x" << std::hex << std::setfill('0') << std::setw(2)
+            //           << this->response.resp_val.checksum.crc32 << std::endl;
+        } else if (this->response.resp_val.checksum.offset < this->bin_bytes_written &&
+                   this->object_retransmits < MAX_OBJECT_RETRANSMITS) {
+            this->object_retransmits++;
+            if (!this->receipts_lost) {
+                this->packets_lost();  // Lost after the last receipt, or without receipts at all
+            }
+            if (this->bin_prefix_match(this->response.resp_val.checksum.offset)) {
+                // Only the tail of the object is missing: resend it from where the device stopped
+                this->bin_bytes_to_write = this->bin_bytes_written - this->response.resp_val.checksum.offset;
+                this->bin_bytes_written = this->response.resp_val.checksum.offset;
+                this->transition<S, BINFILE_WRITE_MTU_CHUNK>();
+            } else {
+                // Packets lost in the middle, the data after the gap is misplaced: create the object again
+                this->bin_bytes_written = this->bin_object_offset;
+                this->transition<S, BINFILE_CREATE_DATA_OBJ>();
+            }
+        } else {
+            this->transition<S, DFU_ERROR_CHECKSUM>();
+            // std::cout << "Invalid Checksum" << std::endl;
+        }
+    } else {
+        this->transition<S, DFU_ERROR>();
+        // std::cout << "Unknow event for the current state" << std::endl;
+    }
+}
+
+// * State table: run() dispatches on the current state with a single indexed call for each half of the step
+
+#define FSM_STATE(S) \
+    { S, fsm_terminal(S), &BasicDfuServer::template fsm_action<S>, &BasicDfuServer::template fsm_event<S> }
+
+template <class Transport>
+constexpr typename BasicDfuServer<Transport>::fsm_state_t BasicDfuServer<Transport>::fsm_table[fsm_state_count] = {
+    FSM_STATE(DFU_IDLE),
+    FSM_STATE(SET_NOTIF_VALUE),
+    FSM_STATE(DATAFILE_CREATE_COM_OBJ),
+    FSM_STATE(DATAFILE_WRITE_FILE),
+    FSM_STATE(DATAFILE_REQ_CHECKSUM),
+    FSM_STATE(DATAFILE_WRITE_EXECUTE),
+    FSM_STATE(BINFILE_CREATE_DATA_OBJ),
+    FSM_STATE(BINFILE_WRITE_MTU_CHUNK),
+    FSM_STATE(BINFILE_REQ_CHECKSUM),
+    FSM_STATE(BINFILE_WRITE_EXECUTE),
+    FSM_STATE(BINFILE_WRITE_EXECUTE_FINAL),
+    FSM_STATE(DFU_ERROR_CHECKSUM),
+    FSM_STATE(DFU_ERROR),
+    FSM_STATE(DFU_FINISHED),
+    FSM_STATE(GET_MTU),
+    FSM_STATE(DATAFILE_SELECT_COM_OBJ),
+    FSM_STATE(BINFILE_SELECT_DATA_OBJ),
+    FSM_STATE(DFU_ERROR_TIMEOUT),
+};
+
+#undef FSM_STATE
+
+template <class Transport>
+constexpr bool BasicDfuServer<Transport>::fsm_table_ordered() {
+    for (size_t state = 0; state < fsm_state_count; state++) {
+        if (fsm_table[state].state != state) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::run() {
+    static_assert(fsm_table_ordered(), "fsm_table must list every state, in state_t order");
+    // std::cout << "Running FSM" << std::endl;
+    const fsm_state_t &current = fsm_table[this->state];
+    (this->*current.action)();
+    if (!this->expected_opcodes.empty()) {
+        this->next_response();
+    }
+    (this->*current.event)();  // Notify Received
+    this->discard_responses();
+    if (this->response_timed_out) {
+        // Whatever state_event made of it, the device is gone: free the session now instead of waiting on it again
+        this->state = DFU_ERROR_TIMEOUT;
+    }
+    // std::cout << "State update to " << this->state << std::endl;
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::next_response() {
+    while (!this->expected_opcodes.empty()) {
+        uint8_t opcode = this->expected_opcodes.front().opcode;
+        std::chrono::milliseconds timeout = (opcode < this->response_timeouts.size())
+                                                ? this->response_timeouts[opcode]
+                                                : std::chrono::milliseconds(RESPONSE_TIMEOUT_MS);
+        if (!this->wait_responses(1, timeout)) {
+            if (this->retry_request()) {
+                continue;
+            }
+            this->response_timed_out = true;
+            this->expected_opcodes.clear();
+            this->received_event = RESPONSE_TIMEOUT;
+            return;
+        }
+        queued_response_t queued = this->responses.front();
+        this->responses.pop_front();
+
+        if (this->stale_response(queued, &this->expected_opcodes.front(), this->prn_draining)) {
+            continue;
+        }
+
+        if (this->last_prn_request(0)) {
+            this->prn_draining = false;
+        }
+        expected_response_t expected = this->expected_opcodes.front();
+        this->expected_opcodes.pop_front();
+        if (expected.internal) {
+            continue;
+        }
+
+        this->response = queued.response;
+        this->received_event = queued.event;
+        if (this->response.request_opcode != expected.opcode) {
+            this->received_event = ERROR_UNEXPECTED_RESP;
+        }
+        return;
+    }
+    this->received_event = NO_EVENT;
+}
+
+template <class Transport>
+bool BasicDfuServer<Transport>::retry_request() {
+    expected_response_t &expected = this->expected_opcodes.front();
+    bool idempotent = expected.opcode == CALCULATE_CHECKSUM_KEY || expected.opcode == SELECT_OBJECT_KEY ||
+                      expected.opcode == PACKET_RECEIPT_NOTIF_REQ_KEY || expected.opcode == MTU_GET_KEY;
+    // Resent behind other requests, its response would come after theirs
+    if (!idempotent || this->expected_opcodes.size() > 1 || expected.retries >= this->request_retries) {
+        return false;
+    }
+    expected.retries++;
+    // If the first request was only late, one more response comes before anything sent after this one
+    this->duplicate_responses[expected.opcode]++;
+    this->duplicate_deadlines[expected.opcode] = deadline_after(this->response_timeouts[expected.opcode]);
+    this->transport.write_request(DFU_CONTROL_POINT, reinterpret_cast<const uint8_t *>(expected.request.data()),
+                                  expected.request.length());
+    return true;
+}
+
+template <class Transport>
+bool BasicDfuServer<Transport>::stale_response(const queued_response_t &queued, const expected_response_t *request,
+                                               bool draining) {
+    if (draining && queued.response.request_opcode == CALCULATE_CHECKSUM_KEY &&
+        (!request || request->opcode != CALCULATE_CHECKSUM_KEY)) {
+        return true;  // Receipt for packets sent before a loss was detected
+    }
+    return this->duplicate_response(queued, request);  // Answer to a request sent again, the first one was only late
+}
+
+template <class Transport>
+bool BasicDfuServer<Transport>::last_prn_request(size_t index) {
+    auto is_prn = [](const expected_response_t &e) { return e.opcode == PACKET_RECEIPT_NOTIF_REQ_KEY; };
+    const expected_response_t &request = this->expected_opcodes[index];
+    // Last PRN value set: device counts packets from zero again, no receipts in flight
+    return request.internal && is_prn(request) &&
+           std::none_of(this->expected_opcodes.begin() + index + 1, this->expected_opcodes.end(), is_prn);
+}
+
+template <class Transport>
+bool BasicDfuServer<Transport>::duplicate_response(const queued_response_t &queued,
+                                                   const expected_response_t *request) {
+    uint8_t opcode = queued.response.request_opcode;
+    auto now = std::chrono::steady_clock::now();
+    bool duplicate = false;
+    for (size_t pending = 0; pending < this->duplicate_responses.size(); pending++) {
+        if (!this->duplicate_responses[pending]) {
+            continue;
+        }
+        if (pending != opcode) {
+            this->duplicate_responses[pending] = 0;  // Answered in order, a duplicate would have come before this
+            continue;
+        }
+        if (request && request->opcode == opcode && request->retries) {
+            continue;  // Answers the request sent again, the duplicate may still follow
+        }
+        // Could also answer a newer request with the same opcode: only a duplicate until the deadline
+        bool ambiguous = !request || request->opcode == opcode;
+        if (ambiguous && now > this->duplicate_deadlines[pending]) {
+            this->duplicate_responses[pending] = 0;  // The first request was lost, not late
+            continue;
+        }
+        this->duplicate_responses[pending]--;
+        duplicate = true;
+    }
+    return duplicate;
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::discard_responses() {
+    while (!this->expected_opcodes.empty()) {
+        this->next_response();
+    }
+    this->wait_responses(0);  // Takes whatever else arrived off the ring
+    this->responses.clear();
+    // Duplicates still due were just dropped with the rest, a later response with their opcode is genuine
+    this->duplicate_responses.fill(0);
+    this->duplicate_deadlines.fill(std::chrono::steady_clock::time_point());
+}
+
+// ! Will be called on a BLE reception via a thread, be careful with raceconditions and synchronization
+template <class Transport>
+void BasicDfuServer<Transport>::push_response(const queued_response_t &queued) {
+    uint32_t head = this->response_ring_head.load(std::memory_order_relaxed);
+    if (head - this->response_ring_tail.load(std::memory_order_acquire) == RESPONSE_RING_SIZE) {
+        // Full, more responses than requests and receipts outstanding. Never blocks the BLE thread, or the FSM thread
+        // of a transport notifying from within its writes: the FSM sees a lost response or receipt instead.
+        this->responses_dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    this->response_ring[head % RESPONSE_RING_SIZE] = queued;
+    // Paired with wait_responses: either the FSM sees the new head, or this sees it going to sleep and wakes it up
+    this->response_ring_head.store(head + 1, std::memory_order_seq_cst);
+    if (this->fsm_sleeping.load(std::memory_order_seq_cst)) {
+        std::lock_guard<std::mutex> guard(mutex_waiting_response);
+        this->cv_waiting_response.notify_one();
+    }
+}
+
+template <class Transport>
+std::chrono::steady_clock::time_point BasicDfuServer<Transport>::deadline_after(std::chrono::milliseconds timeout) {
+    auto now = std::chrono::steady_clock::now();
+    auto never = std::chrono::steady_clock::time_point::max();
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(never - now);
+    return (timeout >= left) ? never : now + timeout;
+}
+
+template <class Transport>
+bool BasicDfuServer<Transport>::wait_responses(size_t count, std::chrono::milliseconds timeout) {
+    auto deadline = deadline_after(timeout);
+    bool forever = (deadline == std::chrono::steady_clock::time_point::max());
+    auto received = [&] {
+        return this->response_ring_head.load(std::memory_order_seq_cst) !=
+               this->response_ring_tail.load(std::memory_order_relaxed);
+    };
+
+    uint32_t spins = 0;
+    while (true) {
+        uint32_t tail = this->response_ring_tail.load(std::memory_order_relaxed);
+        uint32_t head = this->response_ring_head.load(std::memory_order_acquire);
+        for (; tail != head; tail++) {
+            this->responses.push_back(this->response_ring[tail % RESPONSE_RING_SIZE]);
+        }
+        this->response_ring_tail.store(tail, std::memory_order_release);
+        if (this->responses.size() >= count) {
+            return true;
+        }
+
+        if (spins < RESPONSE_SPIN_COUNT) {
+            spins++;
+            std::this_thread::yield();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(mutex_waiting_response);
+        this->fsm_sleeping.store(true, std::memory_order_seq_cst);
+        bool woken = true;
+        if (forever) {
+            cv_waiting_response.wait(lock, received);
+        } else {
+            woken = cv_waiting_response.wait_until(lock, deadline, received);
+        }
+        this->fsm_sleeping.store(false, std::memory_order_relaxed);
+        if (!woken) {
+            return false;
+        }
+    }
+}
+
+template <class Transport>
+event_t BasicDfuServer<Transport>::process_response_data(std::string data, control_point_response_t &response) {
+    uint32_t response_value_len = 0;
+    const uint32_t *response_data_p = nullptr;  // Will point to response value in the received data
+    event_t received_event = NO_EVENT;  // Should never be set!
+
+    response.request_opcode = data[1];
+    response.result_code = data[2];
+    response_value_len = (data.length() - 3);
+
+    if (response.result_code == SUCCESS_RESP) {
+        if (response.request_opcode == CALCULATE_CHECKSUM_KEY) {  // Todo: Validate len
+            response_data_p = reinterpret_cast<uint32_t *>(&data[3]);
+            response.resp_val.checksum.offset = *response_data_p++;
+            response.resp_val.checksum.crc32 = *response_data_p++;
+            received_event = CHECKSUM_RECEIVED;
+        } else if (response.request_opcode == SELECT_OBJECT_KEY) {  // Todo: Validate len
+            response_data_p = reinterpret_cast<uint32_t *>(&data[3]);
+            response.resp_val.select.maximum_size = *response_data_p++;
+            response.resp_val.select.offset = *response_data_p++;
+            response.resp_val.select.crc32 = *response_data_p++;
+            received_event = SELECT_OBJ_RECEIVED;
+        } else if (response.request_opcode == MTU_GET_KEY && response_value_len >= RESPONSE_LEN_MTU) {
+            std::memcpy(&response.resp_val.mtu.size, &data[3], RESPONSE_LEN_MTU);
+            received_event = MTU_RECEIVED;
+        } else if (response_value_len) {
+            // std::cout << " Response value length should be zero for other opcodes " << std::endl;
+            received_event = ERROR_INV_LEN;
+            // Do something
+        } else {
+            switch (response.request_opcode) {
+                case CREATE_KEY:
+                    received_event = CREATE_SUC;
+                    break;
+
+                case PACKET_RECEIPT_NOTIF_REQ_KEY:
+                    received_event = PACKET_RECEIPT_NOTIF_REQ_SUC;
+                    break;
+
+                case EXECUTE_KEY:
+                    received_event = EXECUTE_SUC;
+                    break;
+
+                case SELECT_OBJECT_KEY:
+                    received_event = SELECT_OBJECT_SUC;
+                    break;
+
+                case RESPONSE_CODE_KEY:
+                    received_event = RESPONSE_CODE_SUC;
+                    break;
+
+                default:
+                    received_event = ERROR_UNKNOW_REC_OP;
+                    break;
+            }
+        }
+
+    } else {
+        received_event = ERROR_RECEIVED;
+        // std::cout << " Non success code received " << std::endl;
+    }
+    return received_event;
+}
+
+template <class Transport>
+bool BasicDfuServer<Transport>::checksum_match() {
+    // std::cout << "CRC32 RESULT: 0x" << this->crc32_result << " RECEIVED CRC32: 0x"
+    //           << this->response.resp_val.checksum.crc32 << std::endl;
+    return this->crc32_result == this->response.resp_val.checksum.crc32;
+}
+
+template <class Transport>
+bool BasicDfuServer<Transport>::bin_prefix_match(uint32_t offset) {
+    if (offset < this->bin_object_offset || offset > this->bin_bytes_written) {
+        return false;
+    }
+    return this->object_crc(this->binfile_data.c_str(), offset) == this->response.resp_val.checksum.crc32;
+}
+
+template <class Transport>
+uint32_t BasicDfuServer<Transport>::object_crc(const char *object, uint32_t offset) {
+    if (object != this->binfile_data.c_str()) {
+        return dfu_crc(object, offset);
+    }
+    // Executed data is covered by bin_object_crc, only the data after it is hashed
+    size_t length = offset - this->bin_executed_offset;
+    return dfu_crc_combine(this->bin_object_crc, dfu_crc(&object[this->bin_executed_offset], length), length);
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::calculate_crc(const char *data, size_t length) {
+    // std::cout << "Calculating checksum of length: " << length << std::endl;
+    // std::cout << ToHex( std::string(data,length), true) << std::endl;
+    this->crc32_result = dfu_crc(data, length);
+    // std::cout << "CRC for data to be sent is 0x" << std::hex << std::setfill('0') << std::setw(2) <<
+    // this->crc32_result
+    //           << std::endl;
+}
+
+template <class Transport>
+void BasicDfuServer<Transport>::calculate_bin_crc(size_t length) {
+    size_t page = (length + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE;
+    bool page_end = (length % FLASH_PAGE_SIZE == 0) || (length == this->binfile_data.length());
+    if (page_end && page > 0 && page <= this->bin_page_crcs.size()) {
+        this->crc32_result = this->bin_page_crcs[page - 1];
+        return;
+    }
+
+    if (length < this->bin_crc_offset) {
+        // Rolled back to an earlier object, start over
+        this->bin_crc_remainder = dfu_crc_start();
+        this->bin_crc_offset = 0;
+    }
+
+    const char *data = this->binfile_data.c_str();
+    this->bin_crc_remainder =
+        dfu_crc_update(this->bin_crc_remainder, &data[this->bin_crc_offset], length - this->bin_crc_offset);
+    this->bin_crc_offset = length;
+    this->crc32_result = dfu_crc_finalize(this->bin_crc_remainder);
+}
+
+}  // namespace NativeDFU
@@ -1,21 +1,103 @@
 #pragma once
 
+#include <cstdint>
 #include <functional>
+#include <string>
 
 #define NORDIC_SECURE_DFU_SERVICE "0000fe59-0000-1000-8000-00805f9b34fb"      // Service handle 0x000b
 #define NORDIC_DFU_CONTROL_POINT_CHAR "8ec90001-f315-4f60-9fb8-838830daea50"  // Handle 0x000F
 #define NORDIC_DFU_PACKET_CHAR "8ec90002-f315-4f60-9fb8-838830daea50"         // Handle 0x000D
 
-#define FLASH_PAGE_SIZE 4096
-// TODO: MTU Size will depend on platform (MacOs -.-)
+#define FLASH_PAGE_SIZE 4096  // Data object size until the device reports its maximum
+// Default DFU packet payload: the ATT MTU of 247 bytes most links negotiate, minus the ATT header
 #define MTU_CHUNK 244
+#define ATT_HEADER_LEN 3
+#define ATT_MTU_MIN 23  // Smallest ATT MTU a BLE link can have
+
+// Resends of a single object after the device reports fewer bytes than were sent, before giving up
+#define MAX_OBJECT_RETRANSMITS 8
+// Time to wait for a packet receipt notification before assuming packets were lost
+#define PRN_RECEIPT_TIMEOUT_MS 1000
+// Receipts can't come back faster than a few connection intervals, see transport_capabilities_t
+#define PRN_RECEIPT_TIMEOUT_INTERVALS 8
+// Time to wait for the transport to report room for more write commands before giving up on the object
+#define WRITE_CREDIT_TIMEOUT_MS 1000
+// Time the device has to answer a request, see NrfDfuServer::set_response_timeout. CREATE erases flash and EXECUTE
+// validates the init packet or writes the object to flash, the other requests are answered right away
+#define RESPONSE_TIMEOUT_MS 3000
+#define CREATE_RESPONSE_TIMEOUT_MS 5000
+#define EXECUTE_RESPONSE_TIMEOUT_MS 10000
+// Times a request that is safe to repeat (CALCULATE_CHECKSUM, SELECT, PRN value, MTU_GET) is sent again on a timeout
+#define MAX_REQUEST_RETRIES 2
+// Bulk transfer connection profile requested for the DFU: shortest interval BLE allows, 2M PHY and the longest LL PDU
+#define BULK_CONNECTION_INTERVAL_US 7500
+#define BULK_DATA_LENGTH 251
+// Adaptive window: packets in flight at the start and at least, see NrfDfuServer::set_adaptive_window
+#define PACING_INITIAL_WINDOW 8
+#define PACING_MIN_WINDOW 2
+// Responses on their way from notify to the FSM, far more than the requests and receipts that can be outstanding
+#define RESPONSE_RING_SIZE 64  // Power of two
+// Times the FSM looks for a response again before it sleeps: on a busy link the next one is microseconds away
+#define RESPONSE_SPIN_COUNT 64
 
 #define RESPONSE_LEN_CHECKSUM 8
 #define RESPONSE_LEN_SELECT 12
+#define RESPONSE_LEN_MTU 2
 
 namespace NativeDFU {
 
+// * DFU service characteristics, resolved once from their UUIDs. Transports can map them to GATT attribute handles
+typedef enum { DFU_CONTROL_POINT = 0x00, DFU_PACKET = 0x01, DFU_UNKNOWN_CHAR = 0xFF } dfu_characteristic_t;
+
 typedef std::function<void(std::string service, std::string characteristic, std::string data)> ble_write_t;
+// Non-owning alternative to ble_write_t: data points into the server's buffers and is only valid during the call
+typedef std::function<void(const std::string &service, const std::string &characteristic, const uint8_t *data,
+                           size_t length)>
+    ble_write_view_t;
+// Handle based ble_write_view_t: the characteristic of the DFU service to write to, no UUID strings involved
+typedef std::function<void(dfu_characteristic_t characteristic, const uint8_t *data, size_t length)> ble_write_handle_t;
+
+// * One packet of a batch write, pointing into the server's buffers
+typedef struct {
+    const uint8_t *data;
+    size_t length;
+} packet_view_t;
+
+// Writes count packets back to back, in order. Views are only valid during the call
+typedef std::function<void(dfu_characteristic_t characteristic, const packet_view_t *packets, size_t count)>
+    ble_write_batch_t;
+
+// * Link properties known to the transport, 0 if unknown
+typedef struct {
+    uint16_t att_mtu;                 // Negotiated ATT MTU
+    uint16_t write_queue_depth;       // Write commands the transport buffers, enables write credits
+    uint32_t connection_interval_us;  // Connection interval
+} transport_capabilities_t;
+
+// * Connection parameters, 0 or false keeps the current value
+typedef struct {
+    uint32_t min_interval_us;
+    uint32_t max_interval_us;
+    uint16_t peripheral_latency;
+    uint32_t supervision_timeout_ms;
+    bool phy_2m;
+    uint16_t data_length;  // LL data length extension, bytes per LL PDU
+} connection_profile_t;
+
+// Applies profile to the connection. Returns false if it couldn't, otherwise the profile in force until now is written
+// to previous, if not null
+typedef std::function<bool(const connection_profile_t &profile, connection_profile_t *previous)>
+    ble_connection_profile_t;
+
+// * Transport interface: write callbacks and what the link can do. write_command_batch and set_connection_profile are
+// optional
+typedef struct {
+    ble_write_handle_t write_command;
+    ble_write_handle_t write_request;
+    ble_write_batch_t write_command_batch;
+    transport_capabilities_t capabilities;
+    ble_connection_profile_t set_connection_profile;
+} dfu_transport_t;
 
 // * Opcodes, extended errors not implemented
 typedef enum {
@@ -61,8 +143,26 @@ typedef union {
         uint32_t offset;
         uint32_t crc32;
     } checksum;
+
+    struct {
+        uint16_t size;
+    } mtu;
 } response_value_t;
 
+// * Packet receipt notification expected after some packets
+typedef struct {
+    uint32_t offset;
+    uint32_t crc32;
+} packet_receipt_t;
+
+// * Link statistics measured from packet receipt notifications
+typedef struct {
+    double throughput;  // Bytes per second confirmed by the device, smoothed
+    uint16_t window;    // Packets currently allowed in flight
+    uint32_t losses;    // Times packets were found missing
+    uint32_t responses_dropped;  // Notifications dropped because the response ring was full
+} link_stats_t;
+
 typedef struct {
     uint8_t request_opcode;
     uint8_t result_code;
@@ -84,7 +184,12 @@ typedef enum {
     BINFILE_WRITE_EXECUTE_FINAL,
     DFU_ERROR_CHECKSUM,
     DFU_ERROR,
-    DFU_FINISHED
+    DFU_FINISHED,
+    // Newer states go after DFU_FINISHED, so the values above don't change
+    GET_MTU,
+    DATAFILE_SELECT_COM_OBJ,
+    BINFILE_SELECT_DATA_OBJ,
+    DFU_ERROR_TIMEOUT  // The device stopped answering
 } state_t;
 
 // * FSM Events
@@ -101,7 +206,10 @@ typedef enum {
     ERROR_RECEIVED,
     ERROR_UNKNOW_REC_OP,     // SUCCESS received on unknown OP_CODE
     ERROR_NO_RESP_KEY,       // Received package doesn't start with RESPONSE_CODE_KEY
-    ERROR_NOT_SUP_SERV_CHAR  // Not supported service or characteristic for notify
+    ERROR_NOT_SUP_SERV_CHAR,  // Not supported service or characteristic for notify
+    ERROR_UNEXPECTED_RESP,    // Response to another request than the one expected next
+    MTU_RECEIVED,
+    RESPONSE_TIMEOUT  // No response within the request's timeout, after any retries
 } event_t;
 
 typedef enum { SUCCESS, RESP_ERR_INVALID } error_status_t;
@@ -16,16 +16,12 @@
  **********************************************************************/
 
 #include "crc.h"
+#include "crc_table.h"
 #include <stddef.h>
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wshift-count-overflow"
 
-// Derive parameters from the standard-specific parameters in crc.h.
-
-#define WIDTH (8 * sizeof(crc))
-#define TOPBIT (1 << (WIDTH - 1))
-
 #if (REFLECT_DATA == TRUE)
 #undef REFLECT_DATA
 #define REFLECT_DATA(X) ((unsigned char)reflect((X), 8))
@@ -42,11 +38,93 @@
 #define REFLECT_REMAINDER(X) (X)
 #endif
 
-// CRC table to be used by crcFast()
-static crc crcTable[256];
+#if defined(CRC_REFLECTED_DOMAIN)
+// Number of bytes consumed per step by the table kernel, 8 or 16.
+#ifndef CRC_SLICE_BY
+#define CRC_SLICE_BY 16
+#endif
+
+#if (CRC_SLICE_BY != 8) && (CRC_SLICE_BY != 16)
+#error "CRC_SLICE_BY must be 8 or 16."
+#endif
+#endif
+
+// Table kernel used when no hardware kernel is available.
+#if defined(CRC_REFLECTED_DOMAIN) && (CRC_SLICE_BY == 16)
+#define CRC_KERNEL_TABLE CRC_KERNEL_SLICE16
+#elif defined(CRC_REFLECTED_DOMAIN)
+#define CRC_KERNEL_TABLE CRC_KERNEL_SLICE8
+#else
+#define CRC_KERNEL_TABLE CRC_KERNEL_BYTEWISE
+#endif
+
+// Carry-less multiplication kernel, see crcFoldClmul(). Define CRC_NO_HARDWARE to build the table kernels only.
+#if defined(CRC_REFLECTED_DOMAIN) && !defined(CRC_NO_HARDWARE)
+#if defined(__x86_64__) || defined(_M_X64)
+#define CRC_CLMUL_X86
+#elif defined(__aarch64__) && (defined(__linux__) || defined(__APPLE__))
+#define CRC_CLMUL_ARM
+#endif
+#endif
+
+#if defined(CRC_CLMUL_X86)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define CRC_TARGET_CLMUL
+#else
+#include <cpuid.h>
+#include <immintrin.h>
+#define CRC_TARGET_CLMUL __attribute__((target("pclmul,sse2")))
+#endif
+#elif defined(CRC_CLMUL_ARM)
+#include <arm_neon.h>
+#if defined(__linux__)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+#if defined(__clang__)
+#define CRC_TARGET_CLMUL __attribute__((target("crypto")))
+#else
+#define CRC_TARGET_CLMUL __attribute__((target("+crypto")))
+#endif
+#endif
+
+// The kernel is picked once and shared by every thread. Racing threads all store the same value.
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define CRC_ATOMIC_LOAD(P) _InterlockedCompareExchange((P), CRC_KERNEL_UNRESOLVED, CRC_KERNEL_UNRESOLVED)
+#define CRC_ATOMIC_STORE(P, V) _InterlockedExchange((P), (V))
+#else
+#define CRC_ATOMIC_LOAD(P) __atomic_load_n((P), __ATOMIC_ACQUIRE)
+#define CRC_ATOMIC_STORE(P, V) __atomic_store_n((P), (V), __ATOMIC_RELEASE)
+#endif
+
+#define CRC_KERNEL_UNRESOLVED (-1L)
+
+// Kernel used by crcUpdate(), see crcActiveKernel().
+static long crcActive = CRC_KERNEL_UNRESOLVED;
+
+// CRC tables to be used by crcFast(), generated at compile time (see crc_table.h).
+static crc const (*const crcTable)[256] = crcTables.entry;
 
 static uint32_t reflect(uint32_t data, unsigned char nBits);
 
+static crc crcRun(crcKernel kernel, crc remainder, unsigned char const message[], size_t nBytes);
+
+#if defined(CRC_REFLECTED_DOMAIN)
+static crc crcMultModP(crc a, crc b);
+static crc crcUpdateBytewise(crc remainder, unsigned char const message[], size_t nBytes);
+static crc crcUpdateSlice8(crc remainder, unsigned char const message[], size_t nBytes);
+static crc crcUpdateSlice16(crc remainder, unsigned char const message[], size_t nBytes);
+#endif
+
+#if defined(CRC_CLMUL_X86) || defined(CRC_CLMUL_ARM)
+static int crcCpuHasClmul(void);
+static crc crcFoldClmul(crc remainder, unsigned char const message[], size_t nBytes);
+static crc crcUpdateClmul(crc remainder, unsigned char const message[], size_t nBytes);
+static int crcSelfTest(crcKernel kernel);
+#endif
+
 /*********************************************************************
  *
  * Function:    crcSlow()
@@ -85,63 +163,748 @@ crc crcSlow(unsigned char const message[], size_t nBytes) {
  *
  * Function:    crcInit()
  *
- * Description: Populate the partial CRC lookup table.
+ * Description: Kept for compatibility, does nothing.
  *
- * Notes:		This function must be rerun any time the CRC standard
- *				is changed.  If desired, it can be run "offline" and
- *				the table results stored in an embedded system's ROM.
+ * Notes:		The lookup tables are generated at compile time by
+ *				crc_table.cpp and stored in read-only memory.
  *
  * Returns:		None defined.
  *
  *********************************************************************/
-void crcInit(void) {
-    crc remainder;
+void crcInit(void) {}
 
-    // Compute the remainder of each possible dividend.
-    for (int dividend = 0; dividend < 256; ++dividend) {
-        // Start with the dividend followed by zeros.
-        remainder = dividend << (WIDTH - 8);
+/*********************************************************************
+ *
+ * Function:    crcFast()
+ *
+ * Description: Compute the CRC of a given message.
+ *
+ * Notes:
+ *
+ * Returns:		The CRC of the message.
+ *
+ *********************************************************************/
+crc crcFast(unsigned char const message[], size_t nBytes) {
+    return crcFinalize(crcUpdate(crcStart(), message, nBytes));
+}
 
-        // Perform modulo-2 division, a bit at a time.
-        for (unsigned char bit = 8; bit > 0; --bit) {
-            // Try to divide the current data bit.
-            if (remainder & TOPBIT) {
-                remainder = (remainder << 1) ^ POLYNOMIAL;
-            } else {
-                remainder = (remainder << 1);
-            }
+/*********************************************************************
+ *
+ * Function:    crcStart()
+ *
+ * Description: Begin an incremental CRC computation.
+ *
+ * Notes:
+ *
+ * Returns:		The initial remainder.
+ *
+ *********************************************************************/
+crc crcStart(void) {
+#if defined(CRC_REFLECTED_DOMAIN)
+    return REFLECT_REMAINDER(INITIAL_REMAINDER);
+#else
+    return INITIAL_REMAINDER;
+#endif
+}
+
+/*********************************************************************
+ *
+ * Function:    crcUpdate()
+ *
+ * Description: Extend a running remainder with the next piece of
+ *				a message.
+ *
+ * Notes:
+ *
+ * Returns:		The updated remainder.
+ *
+ *********************************************************************/
+crc crcUpdate(crc remainder, unsigned char const message[], size_t nBytes) {
+    return crcRun(crcActiveKernel(), remainder, message, nBytes);
+}
+
+/*********************************************************************
+ *
+ * Function:    crcFinalize()
+ *
+ * Description: Compute the CRC of the data folded into a running
+ *				remainder.
+ *
+ * Notes:		The remainder is not modified and can be extended
+ *				further with crcUpdate().
+ *
+ * Returns:		The CRC of the message processed so far.
+ *
+ *********************************************************************/
+crc crcFinalize(crc remainder) {
+    // The final remainder is the CRC.
+#if defined(CRC_REFLECTED_DOMAIN)
+    return (remainder ^ FINAL_XOR_VALUE);
+#else
+    return (REFLECT_REMAINDER(remainder) ^ FINAL_XOR_VALUE);
+#endif
+}
+
+/*********************************************************************
+ *
+ * Function:    crcActiveKernel()
+ *
+ * Description: Return the kernel used by crcUpdate().
+ *
+ * Notes:		Resolved on first use: the hardware kernel is only
+ *				picked if the CPU supports it and it matches
+ *				crcSlow() on a test message.
+ *
+ * Returns:		The kernel in use.
+ *
+ *********************************************************************/
+crcKernel crcActiveKernel(void) {
+    long kernel = CRC_ATOMIC_LOAD(&crcActive);
+
+    if (kernel == CRC_KERNEL_UNRESOLVED) {
+        kernel = CRC_KERNEL_TABLE;
+#if defined(CRC_CLMUL_X86) || defined(CRC_CLMUL_ARM)
+        if (crcCpuHasClmul() && crcSelfTest(CRC_KERNEL_CLMUL)) {
+            kernel = CRC_KERNEL_CLMUL;
         }
+#endif
+        CRC_ATOMIC_STORE(&crcActive, kernel);
+    }
+
+    return (crcKernel)kernel;
+}
+
+/*********************************************************************
+ *
+ * Function:    crcKernelSupported()
+ *
+ * Description: Check whether a kernel can run on this CPU.
+ *
+ * Notes:
+ *
+ * Returns:		TRUE if the kernel is supported.
+ *
+ *********************************************************************/
+int crcKernelSupported(crcKernel kernel) {
+    switch (kernel) {
+#if defined(CRC_REFLECTED_DOMAIN)
+        case CRC_KERNEL_BYTEWISE:
+        case CRC_KERNEL_SLICE8:
+        case CRC_KERNEL_SLICE16:
+            return TRUE;
+#else
+        case CRC_KERNEL_BYTEWISE:
+            return TRUE;
+#endif
 
-        // Store the result into the table.
-        crcTable[dividend] = remainder;
+        case CRC_KERNEL_CLMUL:
+            return (crcActiveKernel() == CRC_KERNEL_CLMUL);
+
+        default:
+            return FALSE;
     }
 }
 
 /*********************************************************************
  *
- * Function:    crcFast()
+ * Function:    crcKernelName()
  *
- * Description: Compute the CRC of a given message.
+ * Description: Return a printable name for a kernel.
  *
- * Notes:		crcInit() must be called first.
+ * Notes:
  *
- * Returns:		The CRC of the message.
+ * Returns:		The name of the kernel.
  *
  *********************************************************************/
-crc crcFast(unsigned char const message[], size_t nBytes) {
-    crc remainder = INITIAL_REMAINDER;
+char const *crcKernelName(crcKernel kernel) {
+    switch (kernel) {
+        case CRC_KERNEL_BYTEWISE:
+            return "bytewise";
+
+        case CRC_KERNEL_SLICE8:
+            return "slice-by-8";
+
+        case CRC_KERNEL_SLICE16:
+            return "slice-by-16";
+
+        case CRC_KERNEL_CLMUL:
+#if defined(CRC_CLMUL_ARM)
+            return "pmull";
+#else
+            return "pclmulqdq";
+#endif
+
+        default:
+            return "unknown";
+    }
+}
+
+/*********************************************************************
+ *
+ * Function:    crcUpdateKernel()
+ *
+ * Description: Extend a running remainder using a specific kernel.
+ *
+ * Notes:		Unsupported kernels fall back to the active one.
+ *
+ * Returns:		The updated remainder.
+ *
+ *********************************************************************/
+crc crcUpdateKernel(crcKernel kernel, crc remainder, unsigned char const message[], size_t nBytes) {
+    if (!crcKernelSupported(kernel)) {
+        kernel = crcActiveKernel();
+    }
+
+    return crcRun(kernel, remainder, message, nBytes);
+}
+
+/*********************************************************************
+ *
+ * Function:    crcRun()
+ *
+ * Description: Extend a running remainder using the given kernel.
+ *
+ * Notes:		No check is done that the kernel is supported.
+ *
+ * Returns:		The updated remainder.
+ *
+ *********************************************************************/
+static crc crcRun(crcKernel kernel, crc remainder, unsigned char const message[], size_t nBytes) {
+#if defined(CRC_REFLECTED_DOMAIN)
+    switch (kernel) {
+#if defined(CRC_CLMUL_X86) || defined(CRC_CLMUL_ARM)
+        case CRC_KERNEL_CLMUL:
+            return crcUpdateClmul(remainder, message, nBytes);
+#endif
+
+        case CRC_KERNEL_SLICE16:
+            return crcUpdateSlice16(remainder, message, nBytes);
+
+        case CRC_KERNEL_SLICE8:
+            return crcUpdateSlice8(remainder, message, nBytes);
+
+        default:
+            return crcUpdateBytewise(remainder, message, nBytes);
+    }
+#else
     unsigned char data;
 
+    (void)kernel;
+
     // Divide the message by the polynomial, a byte at a time.
     for (size_t byte = 0; byte < nBytes; ++byte) {
         data = REFLECT_DATA(message[byte]) ^ (remainder >> (WIDTH - 8));
-        remainder = crcTable[data] ^ (remainder << 8);
+        remainder = crcTable[0][data] ^ (remainder << 8);
     }
 
-    // The final remainder is the CRC.
-    return (REFLECT_REMAINDER(remainder) ^ FINAL_XOR_VALUE);
+    return remainder;
+#endif
+}
+
+#if defined(CRC_REFLECTED_DOMAIN)
+
+/*********************************************************************
+ *
+ * Function:    crcCombine()
+ *
+ * Description: Compute the CRC of two concatenated blocks from the
+ *				CRCs of each block.
+ *
+ * Notes:		See crcCombineGen().
+ *
+ * Returns:		The CRC of the concatenation.
+ *
+ *********************************************************************/
+crc crcCombine(crc crcA, crc crcB, size_t lenB) { return crcCombineOp(crcA, crcB, crcCombineGen(lenB)); }
+
+/*********************************************************************
+ *
+ * Function:    crcCombineGen()
+ *
+ * Description: Compute x^(8 * lenB) modulo the polynomial.
+ *
+ * Notes:		Appending lenB bytes to A multiplies its remainder
+ *				by x^(8 * lenB). The power is built by squaring,
+ *				so the cost is O(log lenB).
+ *
+ * Returns:		The operator for crcCombineOp().
+ *
+ *********************************************************************/
+crc crcCombineGen(size_t lenB) {
+    crc power = (crc)1 << (WIDTH - 2);  // x^1, reflected
+    crc op = (crc)1 << (WIDTH - 1);     // x^0, reflected
+
+    // x^8 is the shift for a single byte.
+    for (int square = 0; square < 3; ++square) {
+        power = crcMultModP(power, power);
+    }
+
+    while (lenB) {
+        if (lenB & 1) {
+            op = crcMultModP(power, op);
+        }
+        power = crcMultModP(power, power);
+        lenB >>= 1;
+    }
+
+    return op;
+}
+
+/*********************************************************************
+ *
+ * Function:    crcCombineOp()
+ *
+ * Description: Compute the CRC of two concatenated blocks with a
+ *				precomputed operator.
+ *
+ * Notes:		The initial remainder and final XOR of A and B
+ *				cancel out, so only A has to be shifted.
+ *
+ * Returns:		The CRC of the concatenation.
+ *
+ *********************************************************************/
+crc crcCombineOp(crc crcA, crc crcB, crc op) { return crcMultModP(op, crcA) ^ crcB; }
+
+/*********************************************************************
+ *
+ * Function:    crcMultModP()
+ *
+ * Description: Multiply two reflected polynomials modulo the CRC
+ *				polynomial.
+ *
+ * Notes:
+ *
+ * Returns:		a * b mod P, reflected.
+ *
+ *********************************************************************/
+static crc crcMultModP(crc a, crc b) {
+    crc polynomial = (crc)reflect(POLYNOMIAL, WIDTH);
+    crc bit = (crc)1 << (WIDTH - 1);
+    crc product = 0;
+
+    while (a) {
+        if (a & bit) {
+            product ^= b;
+            a ^= bit;
+        }
+        bit >>= 1;
+        b = (b & 1) ? (b >> 1) ^ polynomial : (b >> 1);
+    }
+
+    return product;
+}
+
+/*********************************************************************
+ *
+ * Function:    crcLoad32()
+ *
+ * Description: Read 4 message bytes as a little-endian word.
+ *
+ * Notes:		Compilers turn this into a single (unaligned) load
+ *				on little-endian targets.
+ *
+ * Returns:		The word.
+ *
+ *********************************************************************/
+static uint32_t crcLoad32(unsigned char const *p) {
+    return ((uint32_t)p[0]) | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/*********************************************************************
+ *
+ * Function:    crcUpdateBytewise()
+ *
+ * Description: Extend a reflected remainder, a byte at a time.
+ *
+ * Notes:		Used for the tail the sliced kernels can't consume.
+ *
+ * Returns:		The updated remainder.
+ *
+ *********************************************************************/
+static crc crcUpdateBytewise(crc remainder, unsigned char const message[], size_t nBytes) {
+    for (size_t byte = 0; byte < nBytes; ++byte) {
+        remainder = crcTable[0][(remainder ^ message[byte]) & 0xFF] ^ (remainder >> 8);
+    }
+
+    return remainder;
+}
+
+/*********************************************************************
+ *
+ * Function:    crcUpdateSlice8()
+ *
+ * Description: Extend a reflected remainder, 8 bytes at a time.
+ *
+ * Notes:		Every byte of the block is looked up in the table
+ *				matching its distance to the end of the block, so
+ *				the 8 lookups are independent of each other.
+ *
+ * Returns:		The updated remainder.
+ *
+ *********************************************************************/
+static crc crcUpdateSlice8(crc remainder, unsigned char const message[], size_t nBytes) {
+    uint32_t one, two;
+
+    while (nBytes >= 8) {
+        one = crcLoad32(message) ^ remainder;
+        two = crcLoad32(message + 4);
+        remainder = crcTable[7][one & 0xFF] ^ crcTable[6][(one >> 8) & 0xFF] ^ crcTable[5][(one >> 16) & 0xFF] ^
+                    crcTable[4][one >> 24] ^ crcTable[3][two & 0xFF] ^ crcTable[2][(two >> 8) & 0xFF] ^
+                    crcTable[1][(two >> 16) & 0xFF] ^ crcTable[0][two >> 24];
+        message += 8;
+        nBytes -= 8;
+    }
+
+    return crcUpdateBytewise(remainder, message, nBytes);
+}
+
+/*********************************************************************
+ *
+ * Function:    crcUpdateSlice16()
+ *
+ * Description: Extend a reflected remainder, 16 bytes at a time.
+ *
+ * Notes:		Same as crcUpdateSlice8() with twice the tables.
+ *
+ * Returns:		The updated remainder.
+ *
+ *********************************************************************/
+static crc crcUpdateSlice16(crc remainder, unsigned char const message[], size_t nBytes) {
+    uint32_t one, two, three, four;
+
+    while (nBytes >= 16) {
+        one = crcLoad32(message) ^ remainder;
+        two = crcLoad32(message + 4);
+        three = crcLoad32(message + 8);
+        four = crcLoad32(message + 12);
+        remainder = crcTable[15][one & 0xFF] ^ crcTable[14][(one >> 8) & 0xFF] ^ crcTable[13][(one >> 16) & 0xFF] ^
+                    crcTable[12][one >> 24] ^ crcTable[11][two & 0xFF] ^ crcTable[10][(two >> 8) & 0xFF] ^
+                    crcTable[9][(two >> 16) & 0xFF] ^ crcTable[8][two >> 24] ^ crcTable[7][three & 0xFF] ^
+                    crcTable[6][(three >> 8) & 0xFF] ^ crcTable[5][(three >> 16) & 0xFF] ^ crcTable[4][three >> 24] ^
+                    crcTable[3][four & 0xFF] ^ crcTable[2][(four >> 8) & 0xFF] ^ crcTable[1][(four >> 16) & 0xFF] ^
+                    crcTable[0][four >> 24];
+        message += 16;
+        nBytes -= 16;
+    }
+
+    return crcUpdateSlice8(remainder, message, nBytes);
 }
 
+#endif
+
+#if defined(CRC_CLMUL_X86) || defined(CRC_CLMUL_ARM)
+
+// Folding constants for the reflected CRC-32 polynomial, from "Fast CRC Computation for Generic Polynomials Using
+// PCLMULQDQ Instruction" (Intel, 2009): x^(4*128+32), x^(4*128-32), x^(128+32), x^(128-32) and x^64 mod P, followed by
+// the Barrett reduction constants P' and u'. All values are bit-reflected.
+#define CRC_FOLD_K1 0x0154442bd4ull
+#define CRC_FOLD_K2 0x01c6e41596ull
+#define CRC_FOLD_K3 0x01751997d0ull
+#define CRC_FOLD_K4 0x00ccaa009eull
+#define CRC_FOLD_K5 0x0163cd6124ull
+#define CRC_FOLD_P 0x01db710641ull
+#define CRC_FOLD_U 0x01f7011641ull
+
+/*********************************************************************
+ *
+ * Function:    crcUpdateClmul()
+ *
+ * Description: Extend a reflected remainder with the carry-less
+ *				multiplication kernel.
+ *
+ * Notes:		Messages shorter than 64 bytes and the tail that
+ *				is not a multiple of 16 bytes go through the table
+ *				kernel.
+ *
+ * Returns:		The updated remainder.
+ *
+ *********************************************************************/
+static crc crcUpdateClmul(crc remainder, unsigned char const message[], size_t nBytes) {
+    size_t folded;
+
+    if (nBytes >= 64) {
+        folded = nBytes & ~(size_t)15;
+        remainder = crcFoldClmul(remainder, message, folded);
+        message += folded;
+        nBytes -= folded;
+    }
+
+    return crcRun(CRC_KERNEL_TABLE, remainder, message, nBytes);
+}
+
+/*********************************************************************
+ *
+ * Function:    crcSelfTest()
+ *
+ * Description: Compare a kernel against crcSlow() on messages of
+ *				several lengths and alignments.
+ *
+ * Notes:
+ *
+ * Returns:		TRUE if every CRC matched.
+ *
+ *********************************************************************/
+static int crcSelfTest(crcKernel kernel) {
+    static size_t const lengths[] = {64, 79, 128, 200, 1021};
+    unsigned char message[1024 + 8];
+    uint32_t seed = 0x2545F491u;
+
+    for (size_t byte = 0; byte < sizeof(message); ++byte) {
+        seed = seed * 1103515245u + 12345u;
+        message[byte] = (unsigned char)(seed >> 16);
+    }
+
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); ++i) {
+        for (size_t offset = 0; offset < 8; offset += 3) {
+            if (crcFinalize(crcRun(kernel, crcStart(), message + offset, lengths[i])) !=
+                crcSlow(message + offset, lengths[i])) {
+                return FALSE;
+            }
+        }
+    }
+
+    return TRUE;
+}
+
+#endif
+
+#if defined(CRC_CLMUL_X86)
+
+/*********************************************************************
+ *
+ * Function:    crcCpuHasClmul()
+ *
+ * Description: Check CPUID for PCLMULQDQ support.
+ *
+ * Notes:
+ *
+ * Returns:		TRUE if the instruction is available.
+ *
+ *********************************************************************/
+static int crcCpuHasClmul(void) {
+#if defined(_MSC_VER)
+    int info[4];
+
+    __cpuid(info, 1);
+    return (info[2] & (1 << 1)) ? TRUE : FALSE;
+#else
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return FALSE;
+    }
+    return (ecx & bit_PCLMUL) ? TRUE : FALSE;
+#endif
+}
+
+/*********************************************************************
+ *
+ * Function:    crcFoldClmul()
+ *
+ * Description: Extend a reflected remainder with PCLMULQDQ folding.
+ *
+ * Notes:		nBytes must be at least 64 and a multiple of 16.
+ *				Four 128-bit accumulators are folded forward 64
+ *				bytes at a time, merged into one, and finally
+ *				reduced to 32 bits with a Barrett reduction.
+ *
+ * Returns:		The updated remainder.
+ *
+ *********************************************************************/
+CRC_TARGET_CLMUL static crc crcFoldClmul(crc remainder, unsigned char const message[], size_t nBytes) {
+    __m128i const k1k2 = _mm_set_epi64x(CRC_FOLD_K2, CRC_FOLD_K1);
+    __m128i const k3k4 = _mm_set_epi64x(CRC_FOLD_K4, CRC_FOLD_K3);
+    __m128i const k5 = _mm_set_epi64x(0, CRC_FOLD_K5);
+    __m128i const poly = _mm_set_epi64x(CRC_FOLD_U, CRC_FOLD_P);
+    __m128i const mask = _mm_setr_epi32(~0, 0, ~0, 0);
+    __m128i x1, x2, x3, x4, x5, x6, x7, x8;
+
+    // Load the first 64 bytes and fold the running remainder into them.
+    x1 = _mm_loadu_si128((__m128i const *)(message + 0x00));
+    x2 = _mm_loadu_si128((__m128i const *)(message + 0x10));
+    x3 = _mm_loadu_si128((__m128i const *)(message + 0x20));
+    x4 = _mm_loadu_si128((__m128i const *)(message + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)remainder));
+    message += 64;
+    nBytes -= 64;
+
+    // Fold the four accumulators over the next 64 bytes.
+    while (nBytes >= 64) {
+        x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((__m128i const *)(message + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((__m128i const *)(message + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((__m128i const *)(message + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((__m128i const *)(message + 0x30)));
+
+        message += 64;
+        nBytes -= 64;
+    }
+
+    // Merge the accumulators into one.
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), x2);
+
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), x3);
+
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), x4);
+
+    // Fold the remaining 16 byte blocks.
+    while (nBytes >= 16) {
+        x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((__m128i const *)message));
+
+        message += 16;
+        nBytes -= 16;
+    }
+
+    // Reduce 128 bits to 64.
+    x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask), k5, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduction to 32 bits.
+    x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask), poly, 0x10);
+    x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, mask), poly, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return (crc)_mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+}
+
+#elif defined(CRC_CLMUL_ARM)
+
+/*********************************************************************
+ *
+ * Function:    crcCpuHasClmul()
+ *
+ * Description: Check the hardware capabilities for PMULL support.
+ *
+ * Notes:		Every Apple AArch64 CPU implements PMULL.
+ *
+ * Returns:		TRUE if the instruction is available.
+ *
+ *********************************************************************/
+static int crcCpuHasClmul(void) {
+#if defined(__linux__)
+    return (getauxval(AT_HWCAP) & HWCAP_PMULL) ? TRUE : FALSE;
+#else
+    return TRUE;
+#endif
+}
+
+/*********************************************************************
+ *
+ * Function:    crcPmull()
+ *
+ * Description: Carry-less multiply two 64-bit values.
+ *
+ * Notes:
+ *
+ * Returns:		The 128-bit product.
+ *
+ *********************************************************************/
+CRC_TARGET_CLMUL static uint64x2_t crcPmull(uint64_t a, uint64_t b) {
+    return vreinterpretq_u64_p128(vmull_p64((poly64_t)a, (poly64_t)b));
+}
+
+/*********************************************************************
+ *
+ * Function:    crcFold128()
+ *
+ * Description: Fold a 128-bit accumulator forward onto new data.
+ *
+ * Notes:		kLow and kHigh multiply the low and high halves of
+ *				the accumulator.
+ *
+ * Returns:		The folded accumulator.
+ *
+ *********************************************************************/
+CRC_TARGET_CLMUL static uint64x2_t crcFold128(uint64x2_t x, uint64_t kLow, uint64_t kHigh, uint64x2_t data) {
+    return veorq_u64(veorq_u64(crcPmull(vgetq_lane_u64(x, 0), kLow), crcPmull(vgetq_lane_u64(x, 1), kHigh)), data);
+}
+
+/*********************************************************************
+ *
+ * Function:    crcFoldClmul()
+ *
+ * Description: Extend a reflected remainder with PMULL folding.
+ *
+ * Notes:		Same algorithm as the PCLMULQDQ kernel, nBytes
+ *				must be at least 64 and a multiple of 16.
+ *
+ * Returns:		The updated remainder.
+ *
+ *********************************************************************/
+CRC_TARGET_CLMUL static crc crcFoldClmul(crc remainder, unsigned char const message[], size_t nBytes) {
+    uint64x2_t x1, x2, x3, x4;
+
+    // Load the first 64 bytes and fold the running remainder into them.
+    x1 = vreinterpretq_u64_u8(vld1q_u8(message + 0x00));
+    x2 = vreinterpretq_u64_u8(vld1q_u8(message + 0x10));
+    x3 = vreinterpretq_u64_u8(vld1q_u8(message + 0x20));
+    x4 = vreinterpretq_u64_u8(vld1q_u8(message + 0x30));
+    x1 = veorq_u64(x1, vsetq_lane_u64((uint64_t)remainder, vdupq_n_u64(0), 0));
+    message += 64;
+    nBytes -= 64;
+
+    // Fold the four accumulators over the next 64 bytes.
+    while (nBytes >= 64) {
+        x1 = crcFold128(x1, CRC_FOLD_K1, CRC_FOLD_K2, vreinterpretq_u64_u8(vld1q_u8(message + 0x00)));
+        x2 = crcFold128(x2, CRC_FOLD_K1, CRC_FOLD_K2, vreinterpretq_u64_u8(vld1q_u8(message + 0x10)));
+        x3 = crcFold128(x3, CRC_FOLD_K1, CRC_FOLD_K2, vreinterpretq_u64_u8(vld1q_u8(message + 0x20)));
+        x4 = crcFold128(x4, CRC_FOLD_K1, CRC_FOLD_K2, vreinterpretq_u64_u8(vld1q_u8(message + 0x30)));
+
+        message += 64;
+        nBytes -= 64;
+    }
+
+    // Merge the accumulators into one.
+    x1 = crcFold128(x1, CRC_FOLD_K3, CRC_FOLD_K4, x2);
+    x1 = crcFold128(x1, CRC_FOLD_K3, CRC_FOLD_K4, x3);
+    x1 = crcFold128(x1, CRC_FOLD_K3, CRC_FOLD_K4, x4);
+
+    // Fold the remaining 16 byte blocks.
+    while (nBytes >= 16) {
+        x1 = crcFold128(x1, CRC_FOLD_K3, CRC_FOLD_K4, vreinterpretq_u64_u8(vld1q_u8(message)));
+
+        message += 16;
+        nBytes -= 16;
+    }
+
+    // Reduce 128 bits to 64.
+    x2 = crcPmull(vgetq_lane_u64(x1, 0), CRC_FOLD_K4);
+    x1 = veorq_u64(vcombine_u64(vget_high_u64(x1), vdup_n_u64(0)), x2);
+
+    x2 = vreinterpretq_u64_u8(vextq_u8(vreinterpretq_u8_u64(x1), vdupq_n_u8(0), 4));
+    x1 = veorq_u64(crcPmull(vgetq_lane_u64(x1, 0) & 0xFFFFFFFFu, CRC_FOLD_K5), x2);
+
+    // Barrett reduction to 32 bits.
+    x2 = crcPmull(vgetq_lane_u64(x1, 0) & 0xFFFFFFFFu, CRC_FOLD_U);
+    x2 = crcPmull(vgetq_lane_u64(x2, 0) & 0xFFFFFFFFu, CRC_FOLD_P);
+    x1 = veorq_u64(x1, x2);
+
+    return (crc)vgetq_lane_u32(vreinterpretq_u32_u64(x1), 1);
+}
+
+#endif
+
 /*********************************************************************
  *
  * Function:    reflect()
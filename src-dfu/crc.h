@@ -71,14 +71,21 @@ typedef uint32_t crc;
 
 #endif
 
+//! Kernels crcUpdate() can run on. CRC_KERNEL_CLMUL folds 64 bytes per step with carry-less multiplication
+//! (PCLMULQDQ on x86-64, PMULL on AArch64) and is picked at runtime when the CPU supports it.
+typedef enum {
+    CRC_KERNEL_BYTEWISE,
+    CRC_KERNEL_SLICE8,
+    CRC_KERNEL_SLICE16,
+    CRC_KERNEL_CLMUL,
+    CRC_KERNEL_COUNT
+} crcKernel;
+
 /**
  * crcInit
  *
- * Populate the partial CRC lookup table.
- *
- * This function must be rerun any time the CRC standard is changed.
- * If desired, it can be run "offline" and the table results stored
- * in an embedded system's memory.
+ * Kept for compatibility, does nothing: the CRC lookup tables are generated at compile time and live in read-only
+ * memory, so they need no initialization and can be shared between threads.
  *
  */
 void crcInit(void);
@@ -87,7 +94,7 @@ void crcInit(void);
  * crcSlow
  *
  * Compute the CRC of a given message.
- * Calculates the CRC without the use of a CRC table, crcInit() doesn't have to be called!
+ * Calculates the CRC without the use of a CRC table.
  * (Slower performance)
  *
  * @param message[]: message/data for which the CRC will be calculated
@@ -100,7 +107,6 @@ crc crcSlow(unsigned char const message[], size_t nBytes);
  * crcFast
  *
  * Compute the CRC of a given message.
- * IMPORTANT:: crcInit() must be called first to use crcFast!
  * (Faster performance)
  *
  * @param message[]: message/data for which the CRC will be calculated
@@ -109,6 +115,148 @@ crc crcSlow(unsigned char const message[], size_t nBytes);
  */
 crc crcFast(unsigned char const message[], size_t nBytes);
 
+#if defined(CRC32)
+
+/**
+ * crcCombine
+ *
+ * Compute the CRC of the concatenation A+B from the CRCs of A and B, without touching the data.
+ *
+ * @param crcA: CRC of the first block (as returned by crcFast())
+ * @param crcB: CRC of the second block
+ * @param lenB: number of bytes in the second block
+ * @return crc: The CRC of both blocks one after the other.
+ */
+crc crcCombine(crc crcA, crc crcB, size_t lenB);
+
+/**
+ * crcCombineGen
+ *
+ * Precompute the operator used by crcCombineOp() for blocks of lenB bytes. Useful when many blocks of the same size
+ * are combined: the operator costs O(log lenB), applying it costs O(1).
+ *
+ * @param lenB: number of bytes in the second block
+ * @return crc: The operator for crcCombineOp().
+ */
+crc crcCombineGen(size_t lenB);
+
+/**
+ * crcCombineOp
+ *
+ * Same as crcCombine() with an operator precomputed by crcCombineGen(lenB).
+ *
+ * @param crcA: CRC of the first block
+ * @param crcB: CRC of the second block
+ * @param op: operator returned by crcCombineGen() for the length of the second block
+ * @return crc: The CRC of both blocks one after the other.
+ */
+crc crcCombineOp(crc crcA, crc crcB, crc op);
+
+/**
+ * crcParallel
+ *
+ * Compute the CRC of a given message, splitting it across worker threads and merging the partial CRCs with
+ * crcCombine(). Small messages are computed on the calling thread.
+ *
+ * @param message[]: message/data for which the CRC will be calculated
+ * @param nBytes: number of bytes in the message/data
+ * @param nThreads: maximum number of threads to use, 0 for one per hardware thread
+ * @return crc: The CRC of the message.
+ */
+crc crcParallel(unsigned char const message[], size_t nBytes, unsigned int nThreads);
+
+/**
+ * crcPrefixTable
+ *
+ * Compute the CRC of every prefix of a message that ends on a stride boundary (and of the whole message), using
+ * worker threads. prefixes[i] is the CRC of the first min((i + 1) * stride, nBytes) bytes.
+ *
+ * @param message[]: message/data for which the CRCs will be calculated
+ * @param nBytes: number of bytes in the message/data
+ * @param stride: distance in bytes between two prefixes, must not be 0
+ * @param prefixes[]: [out] (nBytes + stride - 1) / stride CRCs
+ * @param nThreads: maximum number of threads to use, 0 for one per hardware thread
+ * @return size_t: Number of CRCs written to prefixes.
+ */
+size_t crcPrefixTable(unsigned char const message[], size_t nBytes, size_t stride, crc prefixes[],
+                      unsigned int nThreads);
+
+#endif
+
+/**
+ * crcStart
+ *
+ * Begin an incremental CRC computation. The returned remainder is the CRC context: it is carried through crcUpdate()
+ * and turned into the CRC of everything seen so far with crcFinalize().
+ *
+ * @return crc: The initial remainder.
+ */
+crc crcStart(void);
+
+/**
+ * crcUpdate
+ *
+ * Extend a running remainder with the next piece of a message. Only the new bytes are processed, so checksumming a
+ * growing prefix costs O(new bytes) instead of O(prefix).
+ *
+ * @param remainder: running remainder returned by crcStart() or a previous crcUpdate()
+ * @param message[]: next piece of the message/data
+ * @param nBytes: number of bytes in this piece
+ * @return crc: The updated remainder.
+ */
+crc crcUpdate(crc remainder, unsigned char const message[], size_t nBytes);
+
+/**
+ * crcFinalize
+ *
+ * Compute the CRC of all the data folded into a running remainder. The remainder itself is left untouched, so it can
+ * still be extended with crcUpdate() afterwards.
+ *
+ * @param remainder: running remainder returned by crcUpdate()
+ * @return crc: The CRC of the message processed so far.
+ */
+crc crcFinalize(crc remainder);
+
+/**
+ * crcActiveKernel
+ *
+ * Returns the kernel used by crcFast() and crcUpdate(). On first use the CPU is probed for carry-less multiplication
+ * and the hardware kernel is self-tested against crcSlow(); the table kernel is used if either fails.
+ *
+ * @return crcKernel: The kernel in use.
+ */
+crcKernel crcActiveKernel(void);
+
+/**
+ * crcKernelSupported
+ *
+ * @param kernel: kernel to check
+ * @return int: TRUE if the kernel can run on this CPU.
+ */
+int crcKernelSupported(crcKernel kernel);
+
+/**
+ * crcKernelName
+ *
+ * @param kernel: kernel to name
+ * @return char const *: Printable name of the kernel.
+ */
+char const *crcKernelName(crcKernel kernel);
+
+/**
+ * crcUpdateKernel
+ *
+ * Same as crcUpdate() but forcing a specific kernel, intended for benchmarks and self-tests. An unsupported kernel
+ * falls back to the active one.
+ *
+ * @param kernel: kernel to use
+ * @param remainder: running remainder returned by crcStart() or a previous crcUpdate()
+ * @param message[]: next piece of the message/data
+ * @param nBytes: number of bytes in this piece
+ * @return crc: The updated remainder.
+ */
+crc crcUpdateKernel(crcKernel kernel, crc remainder, unsigned char const message[], size_t nBytes);
+
 #ifdef __cplusplus
 }
 #endif
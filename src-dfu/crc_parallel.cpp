@@ -0,0 +1,96 @@
+/**********************************************************************
+ *
+ * Filename:    crc_parallel.cpp
+ *
+ * Description: Multi-threaded CRC-32 of large messages, built on top
+ *              of crcFast() and crcCombine() from crc.c.
+ *
+ **********************************************************************/
+
+#include "crc.h"
+#include <algorithm>
+#include <thread>
+
+// Below this many bytes per worker, starting a thread costs more than it saves.
+#define CRC_PARALLEL_MIN_CHUNK (256 * 1024)
+#define CRC_PARALLEL_MAX_WORKERS 64
+
+static unsigned int worker_count(size_t nBytes, unsigned int nThreads) {
+    if (nThreads == 0) {
+        nThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    size_t chunks = std::max<size_t>(1, nBytes / CRC_PARALLEL_MIN_CHUNK);
+    return static_cast<unsigned int>(std::min<size_t>({nThreads, chunks, CRC_PARALLEL_MAX_WORKERS}));
+}
+
+// Runs job(0) ... job(workers - 1), job(0) on the calling thread. If a thread can't be started its job runs on the
+// calling thread as well, so no exception ever leaves the C interface.
+template <typename Job>
+static void run_workers(unsigned int workers, const Job &job) {
+    std::thread threads[CRC_PARALLEL_MAX_WORKERS];
+    unsigned int started = 1;
+
+    try {
+        for (; started < workers; started++) {
+            threads[started] = std::thread(job, started);
+        }
+    } catch (...) {
+        // Fall through with the threads started so far.
+    }
+
+    job(0);
+    for (unsigned int worker = started; worker < workers; worker++) {
+        job(worker);
+    }
+    for (unsigned int worker = 1; worker < started; worker++) {
+        threads[worker].join();
+    }
+}
+
+extern "C" crc crcParallel(unsigned char const message[], size_t nBytes, unsigned int nThreads) {
+    unsigned int workers = worker_count(nBytes, nThreads);
+    if (workers == 1) {
+        return crcFast(message, nBytes);
+    }
+
+    crc partial[CRC_PARALLEL_MAX_WORKERS];
+    size_t chunk = nBytes / workers;
+    auto chunk_length = [&](unsigned int worker) { return (worker == workers - 1) ? nBytes - worker * chunk : chunk; };
+
+    run_workers(workers, [&](unsigned int worker) {
+        partial[worker] = crcFast(&message[worker * chunk], chunk_length(worker));
+    });
+
+    crc result = partial[0];
+    for (unsigned int worker = 1; worker < workers; worker++) {
+        result = crcCombine(result, partial[worker], chunk_length(worker));
+    }
+    return result;
+}
+
+extern "C" size_t crcPrefixTable(unsigned char const message[], size_t nBytes, size_t stride, crc prefixes[],
+                                 unsigned int nThreads) {
+    size_t count = (nBytes + stride - 1) / stride;
+    if (count == 0) {
+        return 0;
+    }
+
+    // Checksum every stride on its own, in parallel...
+    unsigned int workers = static_cast<unsigned int>(std::min<size_t>(worker_count(nBytes, nThreads), count));
+    size_t per_worker = (count + workers - 1) / workers;
+    run_workers(workers, [&](unsigned int worker) {
+        size_t last = std::min(count, (worker + 1) * per_worker);
+        for (size_t i = worker * per_worker; i < last; i++) {
+            prefixes[i] = crcFast(&message[i * stride], std::min(stride, nBytes - i * stride));
+        }
+    });
+
+    // ...then chain them into prefixes, which is one multiplication per stride.
+    crc op = crcCombineGen(stride);
+    for (size_t i = 1; i < count; i++) {
+        size_t length = std::min(stride, nBytes - i * stride);
+        prefixes[i] = (length == stride) ? crcCombineOp(prefixes[i - 1], prefixes[i], op)
+                                         : crcCombine(prefixes[i - 1], prefixes[i], length);
+    }
+    return count;
+}
@@ -0,0 +1,95 @@
+/**********************************************************************
+ *
+ * Filename:    crc_table.cpp
+ *
+ * Description: Compile-time generation of the CRC lookup tables.
+ *
+ * Notes:       Same algorithm the former crcInit() ran at startup,
+ *              evaluated by the compiler instead. The result is
+ *              checked against CHECK_VALUE at compile time.
+ *
+ **********************************************************************/
+
+#include "crc_table.h"
+
+namespace {
+
+constexpr crc reflect_bits(crc data, unsigned int nBits) {
+    crc reflection = 0;
+    for (unsigned int bit = 0; bit < nBits; ++bit) {
+        if (data & 0x01) {
+            reflection |= static_cast<crc>(1u << ((nBits - 1) - bit));
+        }
+        data = static_cast<crc>(data >> 1);
+    }
+    return reflection;
+}
+
+constexpr crcTableSet make_tables() {
+    crcTableSet tables{};
+    crc remainder = 0;
+
+#if defined(CRC_REFLECTED_DOMAIN)
+    const crc polynomial = reflect_bits(POLYNOMIAL, WIDTH);
+
+    // Compute the reflected remainder of each possible dividend, a bit at a time starting from the LSB.
+    for (unsigned int dividend = 0; dividend < 256; ++dividend) {
+        remainder = static_cast<crc>(dividend);
+        for (int bit = 8; bit > 0; --bit) {
+            remainder = (remainder & 1) ? static_cast<crc>((remainder >> 1) ^ polynomial)
+                                        : static_cast<crc>(remainder >> 1);
+        }
+        tables.entry[0][dividend] = remainder;
+    }
+
+    // Each further table pushes the result of the previous one through another zero byte.
+    for (int slice = 1; slice < CRC_TABLES; ++slice) {
+        for (unsigned int dividend = 0; dividend < 256; ++dividend) {
+            remainder = tables.entry[slice - 1][dividend];
+            tables.entry[slice][dividend] = static_cast<crc>((remainder >> 8) ^ tables.entry[0][remainder & 0xFF]);
+        }
+    }
+#else
+    // Compute the remainder of each possible dividend followed by zeros.
+    for (unsigned int dividend = 0; dividend < 256; ++dividend) {
+        remainder = static_cast<crc>(dividend << (WIDTH - 8));
+        for (int bit = 8; bit > 0; --bit) {
+            remainder = (remainder & TOPBIT) ? static_cast<crc>((remainder << 1) ^ POLYNOMIAL)
+                                             : static_cast<crc>(remainder << 1);
+        }
+        tables.entry[0][dividend] = remainder;
+    }
+#endif
+
+    return tables;
+}
+
+constexpr crcTableSet tables = make_tables();
+
+// CRC of "123456789" using the generated table, must match the standard's check value.
+constexpr crc check_value() {
+    const char message[] = "123456789";
+    crc remainder = INITIAL_REMAINDER;
+
+    for (unsigned int byte = 0; byte < sizeof(message) - 1; ++byte) {
+#if defined(CRC_REFLECTED_DOMAIN)
+        remainder = static_cast<crc>(tables.entry[0][(remainder ^ message[byte]) & 0xFF] ^ (remainder >> 8));
+#else
+        unsigned char data = static_cast<unsigned char>(REFLECT_DATA ? reflect_bits(message[byte], 8) : message[byte]);
+        remainder = static_cast<crc>(tables.entry[0][data ^ (remainder >> (WIDTH - 8))] ^ (remainder << 8));
+#endif
+    }
+
+#if defined(CRC_REFLECTED_DOMAIN)
+    return static_cast<crc>(remainder ^ FINAL_XOR_VALUE);
+#else
+    return static_cast<crc>((REFLECT_REMAINDER ? reflect_bits(remainder, WIDTH) : remainder) ^ FINAL_XOR_VALUE);
+#endif
+}
+
+static_assert(check_value() == CHECK_VALUE, "Generated CRC table does not produce the standard's CHECK_VALUE");
+
+}  // namespace
+
+// Copy of a constant expression: constant-initialized, so it is placed in read-only data and never written at runtime.
+extern "C" const crcTableSet crcTables = tables;
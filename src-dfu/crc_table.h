@@ -0,0 +1,48 @@
+/**********************************************************************
+ *
+ * Filename:    crc_table.h
+ *
+ * Description: Lookup tables shared by the CRC kernels in crc.c.
+ *
+ * Notes:       The tables are generated at compile time by
+ *              crc_table.cpp and live in read-only memory, so no
+ *              initialization is needed and every thread can use
+ *              them concurrently.
+ *
+ **********************************************************************/
+
+#ifndef _crc_table_h
+#define _crc_table_h
+
+#include "crc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Derive parameters from the standard-specific parameters in crc.h.
+
+#define WIDTH (8 * sizeof(crc))
+#define TOPBIT (1 << (WIDTH - 1))
+
+// CRC-32 is computed directly in the reflected domain: the remainder is kept bit-reversed, so neither the data nor the
+// remainder have to be reflected, and several bytes can be folded per step with extra tables (slicing-by-N).
+#if defined(CRC32)
+#define CRC_REFLECTED_DOMAIN
+#define CRC_TABLES 16
+#else
+#define CRC_TABLES 1
+#endif
+
+//! entry[k][n] is the remainder of byte n followed by k zero bytes.
+typedef struct {
+    crc entry[CRC_TABLES][256];
+} crcTableSet;
+
+extern const crcTableSet crcTables;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _crc_table_h */